@@ -0,0 +1,152 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+
+#include "macros/unwrap.hpp"
+#include "p2p/capture.hpp"
+#include "p2p/websocket-session.hpp"
+#include "util/argument-parser.hpp"
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+struct Counters {
+    std::atomic<uint64_t> successes = 0;
+    std::atomic<uint64_t> errors    = 0;
+    std::atomic<uint64_t> others    = 0;
+};
+
+// sends captured frames and counts responses
+class ReplaySession : public p2p::wss::WebSocketSession {
+  private:
+    Counters* counters;
+
+    auto on_packet_received(const std::span<const std::byte> payload) -> bool override {
+        unwrap(header, p2p::proto::extract_header(payload));
+        switch(header.type) {
+        case p2p::proto::Type::Success:
+            counters->successes.fetch_add(1, std::memory_order_relaxed);
+            break;
+        case p2p::proto::Type::Error:
+            counters->errors.fetch_add(1, std::memory_order_relaxed);
+            break;
+        default:
+            counters->others.fetch_add(1, std::memory_order_relaxed);
+            break;
+        }
+        return true;
+    }
+
+    auto on_disconnected() -> void override {
+    }
+
+  public:
+    auto send_frame(const std::span<const std::byte> frame) -> bool {
+        unwrap(header, p2p::proto::extract_header(frame));
+        send_generic_packet(header.type, header.id, frame.subspan(sizeof(p2p::proto::Packet)));
+        return true;
+    }
+
+    ReplaySession(Counters& counters)
+        : counters(&counters) {}
+
+    ~ReplaySession() {
+        destroy();
+    }
+};
+
+auto run(const int argc, const char* const* const argv) -> bool {
+    auto capture_file      = (const char*)(nullptr);
+    auto address           = "localhost";
+    auto port              = uint16_t(0);
+    auto speed             = uint32_t(1);
+    auto allow_self_signed = false;
+    auto help              = false;
+
+    auto parser = args::Parser<uint16_t, uint32_t>();
+    parser.kwarg(&help, {"-h", "--help"}, {.arg_desc = "print this help message", .state = args::State::Initialized, .no_error_check = true});
+    parser.kwarg(&capture_file, {"-i"}, {"FILE", "capture file recorded with --capture", args::State::Uninitialized});
+    parser.kwarg(&address, {"-s", "--server"}, {"ADDRESS", "server address", args::State::DefaultValue});
+    parser.kwarg(&port, {"-p"}, {"PORT", "server port (default: by captured protocol)", args::State::Initialized});
+    parser.kwarg(&speed, {"--speed"}, {"N", "replay at N times the captured rate, 0 for as fast as possible", args::State::DefaultValue});
+    parser.kwarg(&allow_self_signed, {"-a"}, {"", "allow self signed ssl certificate", args::State::Initialized});
+    if(!parser.parse(argc, argv) || help) {
+        print("usage: capture-replay ", parser.get_help());
+        return true;
+    }
+
+    auto reader = capture::Reader();
+    ensure(reader.open(capture_file));
+    const auto protocol = std::string(reader.get_header().protocol.data());
+    if(port == 0) {
+        ensure(protocol == "peer-linker" || protocol == "channel-hub", "unknown protocol ", protocol, ", specify port");
+        port = protocol == "peer-linker" ? 8080 : 8081;
+    }
+    const auto params = p2p::wss::WebSocketSessionParams{
+        .server    = {address, port},
+        .ssl_level = allow_self_signed ? ws::client::SSLLevel::TrustSelfSigned : ws::client::SSLLevel::Enable,
+        .protocol  = protocol.data(),
+    };
+
+    auto       counters = Counters();
+    auto       sessions = std::unordered_map<uint32_t, std::unique_ptr<ReplaySession>>();
+    auto       frames   = uint64_t(0);
+    auto       bytes    = uint64_t(0);
+    auto       failures = uint64_t(0);
+    auto       max_lag  = Clock::duration();
+    const auto start    = Clock::now();
+    while(const auto record = reader.next()) {
+        const auto& header = *record->header;
+        if(speed != 0) {
+            const auto target = start + std::chrono::nanoseconds(header.time / speed);
+            std::this_thread::sleep_until(target);
+            max_lag = std::max(max_lag, Clock::now() - target);
+        }
+        switch(header.kind) {
+        case capture::RecordKind::Open: {
+            auto session = std::make_unique<ReplaySession>(counters);
+            if(!session->start(params)) {
+                failures += 1;
+                break;
+            }
+            sessions[header.session] = std::move(session);
+        } break;
+        case capture::RecordKind::Frame: {
+            const auto it = sessions.find(header.session);
+            if(it == sessions.end() || !it->second->send_frame(record->payload)) {
+                failures += 1;
+                break;
+            }
+            frames += 1;
+            bytes += record->payload.size();
+        } break;
+        case capture::RecordKind::Close:
+            sessions.erase(header.session);
+            break;
+        }
+    }
+    const auto elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    // wait for responses to the last frames
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    sessions.clear();
+
+    std::printf("protocol: %s\n", protocol.data());
+    std::printf("frames: %llu (%llu bytes) in %.3f s, %.1f frames/s\n",
+                (unsigned long long)frames, (unsigned long long)bytes, elapsed, frames / elapsed);
+    std::printf("responses: success %llu, error %llu, other %llu\n",
+                (unsigned long long)counters.successes.load(), (unsigned long long)counters.errors.load(), (unsigned long long)counters.others.load());
+    std::printf("failures: %llu\n", (unsigned long long)failures);
+    if(speed != 0) {
+        std::printf("max lag behind schedule: %.3f ms\n", std::chrono::duration<double, std::milli>(max_lag).count());
+    }
+    return true;
+}
+} // namespace
+
+auto main(const int argc, const char* const* const argv) -> int {
+    return run(argc, argv) ? 0 : 1;
+}
@@ -0,0 +1,269 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "macros/unwrap.hpp"
+#include "p2p/channel-hub-protocol.hpp"
+#include "p2p/event-manager.hpp"
+#include "p2p/peer-linker-protocol.hpp"
+#include "p2p/protocol-helper.hpp"
+#include "p2p/session-key.hpp"
+#include "util/argument-parser.hpp"
+#include "util/span.hpp"
+#include "util/string-map.hpp"
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+template <class T>
+auto keep(const T& value) -> void {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+struct Result {
+    std::string name;
+    uint64_t    iterations;
+    double      ns_per_op;
+};
+
+struct Harness {
+    std::vector<Result> results;
+    const char*         filter;
+    Clock::duration     min_time;
+    uint32_t            repetitions;
+
+    // body(iterations) runs the operation iterations times
+    // reports the median of repetitions, each running at least min_time
+    template <class Body>
+    auto run(const std::string& name, Body body) -> void {
+        if(filter != nullptr && name.find(filter) == name.npos) {
+            return;
+        }
+        auto iterations = uint64_t(1);
+        while(true) {
+            const auto start   = Clock::now();
+            body(iterations);
+            const auto elapsed = Clock::now() - start;
+            if(elapsed >= min_time || iterations >= (uint64_t(1) << 40)) {
+                break;
+            }
+            iterations *= elapsed * 10 < min_time ? 10 : 2;
+        }
+
+        auto samples = std::vector<double>();
+        for(auto i = 0u; i < repetitions; i += 1) {
+            const auto start   = Clock::now();
+            body(iterations);
+            const auto elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+            samples.push_back(elapsed / iterations);
+        }
+        std::sort(samples.begin(), samples.end());
+        results.push_back({name, iterations, samples[samples.size() / 2]});
+        std::fprintf(stderr, "%-40s %14.1f ns/op\n", name.data(), results.back().ns_per_op);
+    }
+
+    auto to_json(const std::string_view label) const -> std::string {
+        auto ret = build_string("{\n  \"label\": \"", label, "\",\n  \"benchmarks\": [\n");
+        for(auto i = size_t(0); i < results.size(); i += 1) {
+            const auto& result = results[i];
+            ret += build_string("    {\"name\": \"", result.name,
+                                "\", \"iterations\": ", result.iterations,
+                                ", \"ns_per_op\": ", result.ns_per_op,
+                                ", \"ops_per_sec\": ", 1e9 / result.ns_per_op,
+                                "}", i + 1 < results.size() ? ",\n" : "\n");
+        }
+        ret += "  ]\n}\n";
+        return ret;
+    }
+};
+
+auto bench_protocol(Harness& harness) -> void {
+    namespace plink = p2p::plink::proto;
+
+    const auto pad_name = std::string_view("bench-pad-name-0123456789");
+    const auto secret   = std::vector<std::byte>(32);
+    const auto data     = std::vector<std::byte>(1024);
+
+    harness.run("build_packet/success", [](const uint64_t n) {
+        for(auto i = uint64_t(0); i < n; i += 1) {
+            keep(p2p::proto::build_packet(p2p::proto::Type::Success, i));
+        }
+    });
+    harness.run("build_packet/link", [&](const uint64_t n) {
+        for(auto i = uint64_t(0); i < n; i += 1) {
+            keep(p2p::proto::build_packet(plink::Type::Link, i, uint16_t(pad_name.size()), uint16_t(secret.size()), pad_name, std::span<const std::byte>(secret)));
+        }
+    });
+    harness.run("build_packet/passthrough-1k", [&](const uint64_t n) {
+        for(auto i = uint64_t(0); i < n; i += 1) {
+            keep(p2p::proto::build_packet(plink::Type::Limit, i, std::span<const std::byte>(data)));
+        }
+    });
+
+    const auto link = p2p::proto::build_packet(plink::Type::Link, 1, uint16_t(pad_name.size()), uint16_t(secret.size()), pad_name, std::span<const std::byte>(secret));
+    harness.run("extract/header", [&](const uint64_t n) {
+        for(auto i = uint64_t(0); i < n; i += 1) {
+            keep(p2p::proto::extract_header(link));
+        }
+    });
+    harness.run("extract/link", [&](const uint64_t n) {
+        for(auto i = uint64_t(0); i < n; i += 1) {
+            const auto header = p2p::proto::extract_header(link);
+            const auto packet = p2p::proto::extract_payload<plink::Link>(link);
+            keep(header);
+            keep(std::string_view(std::bit_cast<char*>(link.data() + sizeof(plink::Link)), packet->requestee_name_len));
+        }
+    });
+    const auto reg = p2p::proto::build_packet(plink::Type::Register, 1, pad_name);
+    harness.run("extract/last_string", [&](const uint64_t n) {
+        for(auto i = uint64_t(0); i < n; i += 1) {
+            keep(p2p::proto::extract_last_string<plink::Register>(reg));
+        }
+    });
+}
+
+auto bench_events(Harness& harness) -> void {
+    for(const auto threads : {1u, 2u, 4u, 8u}) {
+        harness.run(build_string("events/register_invoke/threads:", threads), [threads](const uint64_t n) {
+            auto events  = p2p::Events();
+            auto count   = std::atomic<uint64_t>(0);
+            auto workers = std::vector<std::thread>();
+            for(auto t = 0u; t < threads; t += 1) {
+                workers.emplace_back([&, t]() {
+                    for(auto i = uint64_t(0); i < n / threads; i += 1) {
+                        const auto id = uint32_t(t << 24 | (i & 0xffffff));
+                        events.register_callback(0, id, [&count](uint32_t) { count.fetch_add(1, std::memory_order_relaxed); });
+                        events.invoke(0, id, 1);
+                    }
+                });
+            }
+            for(auto& worker : workers) {
+                worker.join();
+            }
+            keep(count);
+        });
+    }
+}
+
+auto bench_session_key(Harness& harness) -> void {
+    auto       key  = SessionKey(std::vector<std::byte>(32, std::byte(0x5a)));
+    const auto cert = key.generate_user_certificate("user=bench\nexpire=0");
+    if(!cert) {
+        line_warn("failed to generate certificate, skipping session key benchmarks");
+        return;
+    }
+    const auto parts = SessionKey::split_user_certificate_to_hash_and_content(*cert);
+    harness.run("session_key/verify", [&](const uint64_t n) {
+        for(auto i = uint64_t(0); i < n; i += 1) {
+            keep(key.verify_user_certificate_hash((*parts)[0], (*parts)[1]));
+        }
+    });
+}
+
+auto bench_string_map(Harness& harness) -> void {
+    struct Pad {
+        std::string name;
+        void*       session = nullptr;
+    };
+
+    for(const auto size : {10'000u, 100'000u, 1'000'000u}) {
+        auto pads  = StringMap<Pad>();
+        auto names = std::vector<std::string>();
+        for(auto i = 0u; i < size; i += 1) {
+            auto name = build_string("pad-", i, "-", i * 2654435761u);
+            pads.emplace(name, Pad{name});
+            names.push_back(std::move(name));
+        }
+        harness.run(build_string("string_map/find/entries:", size), [&](const uint64_t n) {
+            for(auto i = uint64_t(0); i < n; i += 1) {
+                keep(pads.find(std::string_view(names[(i * 7919) % size])));
+            }
+        });
+        harness.run(build_string("string_map/miss/entries:", size), [&](const uint64_t n) {
+            for(auto i = uint64_t(0); i < n; i += 1) {
+                keep(pads.find(std::string_view("pad-not-registered")));
+            }
+        });
+    }
+}
+
+auto bench_get_channels(Harness& harness) -> void {
+    struct Channel {
+        std::string name;
+    };
+
+    for(const auto size : {10u, 1'000u, 100'000u}) {
+        auto channels = StringMap<Channel>();
+        for(auto i = 0u; i < size; i += 1) {
+            const auto name = build_string("room-", i, "-audiovideo");
+            channels.emplace(name, Channel{name});
+        }
+        // same as the GetChannels handler in channel-hub
+        harness.run(build_string("get_channels/serialize/channels:", size), [&](const uint64_t n) {
+            for(auto i = uint64_t(0); i < n; i += 1) {
+                auto payload = std::vector<std::byte>();
+                for(auto it = channels.begin(); it != channels.end(); it = std::next(it)) {
+                    const auto& name      = it->second.name;
+                    const auto  prev_size = payload.size();
+                    payload.resize(prev_size + name.size() + 1);
+                    std::memcpy(payload.data() + prev_size, name.data(), name.size() + 1);
+                }
+                keep(p2p::proto::build_packet(p2p::chub::proto::Type::GetChannelsResponse, i, std::span<const std::byte>(payload)));
+            }
+        });
+    }
+}
+
+auto run(const int argc, const char* const* const argv) -> bool {
+    auto filter      = (const char*)(nullptr);
+    auto output      = (const char*)(nullptr);
+    auto label       = "";
+    auto min_time_ms = uint32_t(200);
+    auto repetitions = uint32_t(5);
+    auto help        = false;
+
+    auto parser = args::Parser<uint32_t>();
+    parser.kwarg(&help, {"-h", "--help"}, {.arg_desc = "print this help message", .state = args::State::Initialized, .no_error_check = true});
+    parser.kwarg(&filter, {"-f", "--filter"}, {"PATTERN", "run benchmarks containing PATTERN in their names", args::State::Initialized});
+    parser.kwarg(&output, {"-o", "--output"}, {"FILE", "write json results to FILE instead of stdout", args::State::Initialized});
+    parser.kwarg(&label, {"--label"}, {"LABEL", "label recorded in the results, e.g. a commit hash", args::State::DefaultValue});
+    parser.kwarg(&min_time_ms, {"--min-time"}, {"MS", "minimum duration of each repetition", args::State::DefaultValue});
+    parser.kwarg(&repetitions, {"--repetitions"}, {"N", "repetitions to take the median of", args::State::DefaultValue});
+    if(!parser.parse(argc, argv) || help) {
+        print("usage: benchmarks ", parser.get_help());
+        return true;
+    }
+
+    auto harness = Harness{
+        .filter      = filter,
+        .min_time    = std::chrono::milliseconds(min_time_ms),
+        .repetitions = std::max(repetitions, uint32_t(1)),
+    };
+    bench_protocol(harness);
+    bench_events(harness);
+    bench_session_key(harness);
+    bench_string_map(harness);
+    bench_get_channels(harness);
+
+    const auto json = harness.to_json(label);
+    if(output == nullptr) {
+        std::fwrite(json.data(), 1, json.size(), stdout);
+        return true;
+    }
+    const auto file = std::fopen(output, "w");
+    ensure(file != nullptr, "failed to open output file");
+    const auto written = std::fwrite(json.data(), 1, json.size(), file);
+    std::fclose(file);
+    ensure(written == json.size());
+    return true;
+}
+} // namespace
+
+auto main(const int argc, const char* const* const argv) -> int {
+    return run(argc, argv) ? 0 : 1;
+}
@@ -0,0 +1,395 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <thread>
+#include <utility>
+
+#include "macros/unwrap.hpp"
+#include "p2p/channel-hub-client.hpp"
+#include "p2p/peer-linker-protocol.hpp"
+#include "p2p/websocket-session.hpp"
+#include "util/argument-parser.hpp"
+#include "util/file-io.hpp"
+#include "util/span.hpp"
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+struct Op {
+    enum {
+        Activate,
+        Register,
+        Link,
+        Unlink,
+        Unregister,
+        Relay, // one-way, sender to receiver
+        RegisterChannel,
+        GetChannels,
+        PadRequest,
+
+        Limit,
+    };
+};
+
+constexpr auto op_names = std::array{
+    "activate",
+    "register",
+    "link",
+    "unlink",
+    "unregister",
+    "relay",
+    "register-channel",
+    "get-channels",
+    "pad-request",
+};
+static_assert(Op::Limit == op_names.size());
+
+struct Type {
+    enum : uint16_t {
+        Data = p2p::plink::proto::Type::Limit, // passthroughed by the server
+
+        Limit,
+    };
+};
+
+struct Data : p2p::proto::Packet {
+    int64_t sent_at; // steady clock in nanoseconds
+    // std::byte padding[];
+};
+
+struct Samples {
+    std::array<std::vector<uint32_t>, Op::Limit> latencies; // in microseconds
+    uint64_t                                     errors = 0;
+
+    auto record(const int op, const Clock::duration duration) -> void {
+        latencies[op].push_back(std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+    }
+
+    auto merge(Samples& other) -> void {
+        for(auto op = 0; op < Op::Limit; op += 1) {
+            auto& dst = latencies[op];
+            auto& src = other.latencies[op];
+            dst.insert(dst.end(), src.begin(), src.end());
+            src.clear();
+        }
+        errors += std::exchange(other.errors, 0);
+    }
+};
+
+struct Config {
+    p2p::wss::ServerLocation peer_linker;
+    p2p::wss::ServerLocation channel_hub;
+    std::string              user_cert;
+    uint32_t                 relay_rate;
+    uint32_t                 relay_size;
+    bool                     allow_self_signed;
+};
+
+auto timed(Samples& samples, const int op, const bool result, const Clock::time_point start) -> bool {
+    if(!result) {
+        samples.errors += 1;
+        return false;
+    }
+    samples.record(op, Clock::now() - start);
+    return true;
+}
+
+#define time_op(samples, op, ...)                                           \
+    {                                                                       \
+        const auto start = Clock::now();                                    \
+        ensure(timed(samples, op, bool(__VA_ARGS__), start), op_names[op]); \
+    }
+
+// minimal peer-linker client accepting every link request
+class BenchPad : public p2p::wss::WebSocketSession {
+  private:
+    struct EventKind {
+        enum {
+            Linked = p2p::wss::EventKind::Limit,
+
+            Limit,
+        };
+    };
+
+    Samples received; // written by the signaling thread only
+
+    auto on_packet_received(const std::span<const std::byte> payload) -> bool override {
+        namespace proto = p2p::plink::proto;
+
+        unwrap(header, p2p::proto::extract_header(payload));
+        switch(header.type) {
+        case proto::Type::LinkAuth: {
+            unwrap(packet, p2p::proto::extract_payload<proto::LinkAuth>(payload));
+            const auto requester_name = std::string_view(std::bit_cast<char*>(payload.data() + sizeof(proto::LinkAuth)), packet.requester_name_len);
+            send_packet_detached(proto::Type::LinkAuthResponse, [](uint32_t) {}, uint16_t(1), requester_name);
+            return true;
+        }
+        case proto::Type::LinkSuccess:
+            events.invoke(EventKind::Linked, p2p::no_id, 1);
+            return true;
+        case proto::Type::LinkDenied:
+            events.invoke(EventKind::Linked, p2p::no_id, 0);
+            return true;
+        case proto::Type::Unlinked:
+        case proto::Type::ResumeToken:
+            return true;
+        case Type::Data: {
+            unwrap(packet, p2p::proto::extract_payload<Data>(payload));
+            received.record(Op::Relay, Clock::now().time_since_epoch() - std::chrono::nanoseconds(packet.sent_at));
+            return true;
+        }
+        default:
+            return p2p::wss::WebSocketSession::on_packet_received(payload);
+        }
+    }
+
+    auto on_disconnected() -> void override {
+    }
+
+  public:
+    auto connect(const Config& config) -> bool {
+        return start({
+            .server    = config.peer_linker,
+            .ssl_level = config.allow_self_signed ? ws::client::SSLLevel::TrustSelfSigned : ws::client::SSLLevel::Enable,
+            .protocol  = "peer-linker",
+        });
+    }
+
+    auto wait_linked() -> bool {
+        unwrap(result, wait_for_event(EventKind::Linked));
+        return result == 1;
+    }
+
+    // disconnect and collect received relay latencies
+    auto finish() -> Samples& {
+        destroy();
+        return received;
+    }
+
+    ~BenchPad() {
+        destroy();
+    }
+};
+
+auto setup_pair(Samples& samples, const Config& config, BenchPad& a, BenchPad& b, const std::string& name_a, const std::string& name_b) -> bool {
+    namespace proto = p2p::plink::proto;
+
+    ensure(a.connect(config));
+    ensure(b.connect(config));
+    time_op(samples, Op::Activate, a.send_packet(p2p::proto::Type::ActivateSession, config.user_cert));
+    time_op(samples, Op::Activate, b.send_packet(p2p::proto::Type::ActivateSession, config.user_cert));
+    time_op(samples, Op::Register, a.send_packet(proto::Type::Register, name_a));
+    time_op(samples, Op::Register, b.send_packet(proto::Type::Register, name_b));
+    time_op(samples, Op::Link, a.send_packet(proto::Type::Link, uint16_t(name_b.size()), uint16_t(0), name_b) && a.wait_linked());
+    return true;
+}
+
+// connect, register and link a pair of pads, then tear it down
+auto run_churn_iteration(Samples& samples, const Config& config, const std::string& prefix) -> bool {
+    namespace proto = p2p::plink::proto;
+
+    auto a = BenchPad();
+    auto b = BenchPad();
+    ensure(setup_pair(samples, config, a, b, prefix + "a", prefix + "b"));
+    time_op(samples, Op::Unlink, a.send_packet(proto::Type::Unlink));
+    time_op(samples, Op::Unregister, a.send_packet(proto::Type::Unregister));
+    time_op(samples, Op::Unregister, b.send_packet(proto::Type::Unregister));
+    return true;
+}
+
+// stream passthrough packets over a linked pair at a fixed rate
+auto run_relay(Samples& samples, const Config& config, const std::string& prefix, const Clock::time_point deadline) -> bool {
+    auto a = BenchPad();
+    auto b = BenchPad();
+    ensure(setup_pair(samples, config, a, b, prefix + "a", prefix + "b"));
+
+    const auto padding  = std::vector<std::byte>(config.relay_size > sizeof(Data) ? config.relay_size - sizeof(Data) : 0);
+    const auto interval = std::chrono::nanoseconds(std::chrono::seconds(1)) / std::max(config.relay_rate, uint32_t(1));
+    for(auto next = Clock::now(); next < deadline; next += interval) {
+        std::this_thread::sleep_until(next);
+        const auto now = std::chrono::nanoseconds(Clock::now().time_since_epoch()).count();
+        a.send_generic_packet(Type::Data, 0, int64_t(now), std::span<const std::byte>(padding));
+    }
+    // let in-flight packets arrive
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    a.stop();
+    samples.merge(b.finish());
+    return true;
+}
+
+class BenchChannelSender : public p2p::chub::ChannelHubSender {
+  private:
+    uint32_t pad_id = 0;
+
+    auto on_pad_request(const uint16_t request_id, const std::string_view channel_name) -> bool override {
+        notify_pad_created(request_id, build_string(channel_name, "-pad-", pad_id += 1));
+        return true;
+    }
+
+    auto on_disconnected() -> void override {
+    }
+
+  public:
+    ~BenchChannelSender() {
+        destroy();
+    }
+};
+
+class BenchChannelReceiver : public p2p::chub::ChannelHubReceiver {
+  private:
+    auto on_disconnected() -> void override {
+    }
+
+  public:
+    ~BenchChannelReceiver() {
+        destroy();
+    }
+};
+
+// channel registration churn, listing and pad requests
+auto run_chub(Samples& samples, const Config& config, const std::string& prefix, const Clock::time_point deadline) -> bool {
+    const auto params  = p2p::chub::ChannelHubSessionParams{config.channel_hub, config.user_cert, {}, config.allow_self_signed};
+    const auto channel = prefix + "channel";
+
+    auto sender   = BenchChannelSender();
+    auto receiver = BenchChannelReceiver();
+    time_op(samples, Op::Activate, sender.start(params));
+    time_op(samples, Op::Activate, receiver.start(params));
+    time_op(samples, Op::RegisterChannel, sender.register_channel(channel));
+    for(auto iteration = 0; Clock::now() < deadline; iteration += 1) {
+        const auto temporary = build_string(prefix, "temporary-", iteration);
+        time_op(samples, Op::RegisterChannel, sender.register_channel(temporary));
+        ensure(sender.unregister_channel(temporary));
+        time_op(samples, Op::GetChannels, receiver.get_channels().has_value());
+        time_op(samples, Op::PadRequest, receiver.request_pad(channel).has_value());
+    }
+    return true;
+}
+
+auto read_rss(const uint32_t pid) -> std::string {
+    auto file = std::ifstream(build_string("/proc/", pid, "/status"));
+    auto line = std::string();
+    auto ret  = std::string();
+    while(std::getline(file, line)) {
+        if(line.starts_with("VmRSS:") || line.starts_with("VmHWM:")) {
+            ret += line + "\n";
+        }
+    }
+    return ret;
+}
+
+auto percentile(const std::vector<uint32_t>& sorted, const double p) -> uint32_t {
+    return sorted.empty() ? 0 : sorted[std::min(size_t(sorted.size() * p), sorted.size() - 1)];
+}
+
+auto report(Samples& samples, const double elapsed) -> void {
+    std::printf("%-18s %10s %10s %10s %10s %10s\n", "operation", "count", "ops/s", "p50(us)", "p99(us)", "p999(us)");
+    for(auto op = 0; op < Op::Limit; op += 1) {
+        auto& latencies = samples.latencies[op];
+        if(latencies.empty()) {
+            continue;
+        }
+        std::sort(latencies.begin(), latencies.end());
+        std::printf("%-18s %10zu %10.1f %10u %10u %10u\n",
+                    op_names[op], latencies.size(), latencies.size() / elapsed,
+                    percentile(latencies, 0.5), percentile(latencies, 0.99), percentile(latencies, 0.999));
+    }
+    std::printf("errors: %llu\n", (unsigned long long)samples.errors);
+}
+
+auto run(const int argc, const char* const* const argv) -> bool {
+    auto address           = "localhost";
+    auto plink_port        = uint16_t(8080);
+    auto chub_port         = uint16_t(8081);
+    auto churn_workers     = uint32_t(0);
+    auto relay_workers     = uint32_t(0);
+    auto chub_workers      = uint32_t(0);
+    auto duration          = uint32_t(10);
+    auto relay_rate        = uint32_t(100);
+    auto relay_size        = uint32_t(256);
+    auto server_pid        = uint32_t(0);
+    auto cert_file         = (const char*)(nullptr);
+    auto allow_self_signed = false;
+    auto help              = false;
+
+    auto parser = args::Parser<uint16_t, uint8_t, uint32_t>();
+    parser.kwarg(&help, {"-h", "--help"}, {.arg_desc = "print this help message", .state = args::State::Initialized, .no_error_check = true});
+    parser.kwarg(&address, {"-s", "--server"}, {"ADDRESS", "server address", args::State::DefaultValue});
+    parser.kwarg(&plink_port, {"-p"}, {"PORT", "peer-linker port", args::State::DefaultValue});
+    parser.kwarg(&chub_port, {"-c"}, {"PORT", "channel-hub port", args::State::DefaultValue});
+    parser.kwarg(&churn_workers, {"--churn"}, {"N", "pairs repeating connect, register, link and teardown", args::State::DefaultValue});
+    parser.kwarg(&relay_workers, {"--relay"}, {"N", "linked pairs streaming passthrough packets", args::State::DefaultValue});
+    parser.kwarg(&chub_workers, {"--chub"}, {"N", "channel-hub sender and receiver pairs", args::State::DefaultValue});
+    parser.kwarg(&duration, {"-d", "--duration"}, {"SEC", "benchmark duration", args::State::DefaultValue});
+    parser.kwarg(&relay_rate, {"--relay-rate"}, {"N", "passthrough packets per second per pair", args::State::DefaultValue});
+    parser.kwarg(&relay_size, {"--relay-size"}, {"BYTES", "passthrough packet size", args::State::DefaultValue});
+    parser.kwarg(&server_pid, {"--server-pid"}, {"PID", "report memory usage of the server process", args::State::Initialized});
+    parser.kwarg(&cert_file, {"-k"}, {"CERT_FILE", "use user certificate", args::State::Initialized});
+    parser.kwarg(&allow_self_signed, {"-a"}, {"", "allow self signed ssl certificate", args::State::Initialized});
+    if(!parser.parse(argc, argv) || help) {
+        print("usage: signaling-bench ", parser.get_help());
+        return true;
+    }
+    ensure(churn_workers + relay_workers + chub_workers > 0, "no workers specified");
+
+    auto config = Config{
+        .peer_linker       = {address, plink_port},
+        .channel_hub       = {address, chub_port},
+        .relay_rate        = relay_rate,
+        .relay_size        = relay_size,
+        .allow_self_signed = allow_self_signed,
+    };
+    if(cert_file != nullptr) {
+        unwrap(cert, read_file(cert_file));
+        config.user_cert = from_span(cert);
+    }
+
+    const auto started  = Clock::now();
+    const auto deadline = started + std::chrono::seconds(duration);
+    const auto workers  = churn_workers + relay_workers + chub_workers;
+
+    auto samples = std::vector<Samples>(workers);
+    auto threads = std::vector<std::thread>();
+    for(auto i = 0u; i < workers; i += 1) {
+        threads.emplace_back([&, i]() -> void {
+            auto& local = samples[i];
+            if(i < churn_workers) {
+                for(auto iteration = 0; Clock::now() < deadline; iteration += 1) {
+                    if(!run_churn_iteration(local, config, build_string("bench-churn-", i, "-", iteration, "-"))) {
+                        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                    }
+                }
+            } else if(i < churn_workers + relay_workers) {
+                if(!run_relay(local, config, build_string("bench-relay-", i, "-"), deadline)) {
+                    line_warn("relay worker ", i, " failed");
+                }
+            } else {
+                if(!run_chub(local, config, build_string("bench-chub-", i, "-"), deadline)) {
+                    line_warn("channel-hub worker ", i, " failed");
+                }
+            }
+        });
+    }
+    for(auto& thread : threads) {
+        thread.join();
+    }
+    const auto elapsed = std::chrono::duration<double>(Clock::now() - started).count();
+
+    auto total = Samples();
+    for(auto& local : samples) {
+        total.merge(local);
+    }
+    report(total, elapsed);
+    if(server_pid != 0) {
+        std::printf("server memory:\n%s", read_rss(server_pid).data());
+    }
+    return true;
+}
+} // namespace
+
+auto main(const int argc, const char* const* const argv) -> int {
+    return run(argc, argv) ? 0 : 1;
+}
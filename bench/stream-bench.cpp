@@ -0,0 +1,187 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "macros/unwrap.hpp"
+#include "p2p/ice-session-protocol.hpp"
+#include "p2p/reliable-stream.hpp"
+#include "util/argument-parser.hpp"
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+struct LinkParams {
+    std::chrono::microseconds delay;      // one way
+    double                    loss;       // probability
+    uint64_t                  rate;       // bytes per second, 0 for unlimited
+    size_t                    queue_size; // bytes, tail drop beyond
+};
+
+// one direction of an emulated path between two streams in this process
+class Link {
+  private:
+    struct Datagram {
+        Clock::time_point      deliver_at;
+        std::vector<std::byte> data;
+    };
+
+    LinkParams                             params;
+    p2p::ice::ReliableStream*              receiver;
+    std::mutex                             lock;
+    std::condition_variable                condvar;
+    std::deque<Datagram>                   queue;
+    size_t                                 queued = 0;
+    Clock::time_point                      tx_free_at;
+    std::minstd_rand                       random;
+    std::uniform_real_distribution<double> uniform;
+    std::thread                            worker;
+    bool                                   stopping = false;
+
+    auto worker_main() -> void {
+        auto guard = std::unique_lock(lock);
+        while(!stopping) {
+            if(queue.empty()) {
+                condvar.wait(guard);
+                continue;
+            }
+            if(const auto deliver_at = queue.front().deliver_at; Clock::now() < deliver_at) {
+                condvar.wait_until(guard, deliver_at);
+                continue;
+            }
+            auto datagram = std::move(queue.front());
+            queue.pop_front();
+            guard.unlock();
+            receiver->on_datagram(datagram.data);
+            guard.lock();
+            queued -= datagram.data.size();
+        }
+    }
+
+  public:
+    uint64_t dropped = 0;
+
+    auto send(const std::span<const std::byte> data) -> bool {
+        auto guard = std::lock_guard(lock);
+        if(uniform(random) < params.loss || queued + data.size() > params.queue_size) {
+            dropped += 1;
+            return true;
+        }
+        const auto now = Clock::now();
+        tx_free_at     = std::max(tx_free_at, now);
+        if(params.rate != 0) {
+            tx_free_at += std::chrono::nanoseconds(data.size() * 1'000'000'000 / params.rate);
+        }
+        queue.push_back({tx_free_at + params.delay, std::vector<std::byte>(data.begin(), data.end())});
+        queued += data.size();
+        condvar.notify_one();
+        return true;
+    }
+
+    auto start(const LinkParams& params, p2p::ice::ReliableStream& receiver, const uint32_t seed) -> void {
+        this->params   = params;
+        this->receiver = &receiver;
+        random.seed(seed);
+        worker = std::thread(&Link::worker_main, this);
+    }
+
+    ~Link() {
+        {
+            auto guard = std::lock_guard(lock);
+            stopping   = true;
+            condvar.notify_one();
+        }
+        if(worker.joinable()) {
+            worker.join();
+        }
+    }
+};
+
+auto run(const int argc, const char* const* const argv) -> bool {
+    auto size_mb    = uint32_t(256);
+    auto chunk_size = uint32_t(64 * 1024);
+    auto delay_ms   = uint32_t(0);
+    auto loss_ppm   = uint32_t(0);
+    auto rate_mbps  = uint32_t(0);
+    auto queue_kb   = uint32_t(1024);
+    auto help       = false;
+
+    auto parser = args::Parser<uint32_t>();
+    parser.kwarg(&help, {"-h", "--help"}, {.arg_desc = "print this help message", .state = args::State::Initialized, .no_error_check = true});
+    parser.kwarg(&size_mb, {"-s", "--size"}, {"MB", "bytes to transfer", args::State::DefaultValue});
+    parser.kwarg(&chunk_size, {"--chunk"}, {"BYTES", "size of each write", args::State::DefaultValue});
+    parser.kwarg(&delay_ms, {"--delay"}, {"MS", "one way delay of the emulated link", args::State::DefaultValue});
+    parser.kwarg(&loss_ppm, {"--loss"}, {"PPM", "random loss in parts per million", args::State::DefaultValue});
+    parser.kwarg(&rate_mbps, {"--rate"}, {"MBPS", "bottleneck rate in megabits per second, 0 for unlimited", args::State::DefaultValue});
+    parser.kwarg(&queue_kb, {"--queue"}, {"KB", "bottleneck queue size", args::State::DefaultValue});
+    if(!parser.parse(argc, argv) || help) {
+        print("usage: stream-bench ", parser.get_help());
+        return true;
+    }
+
+    const auto link_params = LinkParams{
+        .delay      = std::chrono::milliseconds(delay_ms),
+        .loss       = loss_ppm / 1e6,
+        .rate       = uint64_t(rate_mbps) * 1000 * 1000 / 8,
+        .queue_size = size_t(queue_kb) * 1024,
+    };
+    const auto total = uint64_t(size_mb) * 1024 * 1024;
+
+    auto sender   = p2p::ice::ReliableStream();
+    auto receiver = p2p::ice::ReliableStream();
+    auto forward  = Link();
+    auto backward = Link();
+
+    auto received  = std::atomic<uint64_t>(0);
+    auto corrupted = std::atomic<bool>(false);
+    auto done      = std::promise<void>();
+    auto finished  = done.get_future();
+    auto pattern   = [](const uint64_t offset) { return std::byte(offset * 131 >> 8); };
+
+    using Kind = p2p::ice::proto::DatagramKind;
+    sender.start({}, Kind::StreamData, Kind::StreamAck, [&](auto datagram) { return forward.send(datagram); }, [](auto) {});
+    receiver.start({}, Kind::StreamData, Kind::StreamAck, [&](auto datagram) { return backward.send(datagram); }, [&](const std::span<const std::byte> payload) {
+        const auto offset = received.load();
+        for(auto i = size_t(0); i < payload.size(); i += 997) {
+            if(payload[i] != pattern(offset + i)) {
+                corrupted = true;
+            }
+        }
+        if(received.fetch_add(payload.size()) + payload.size() == total) {
+            done.set_value();
+        }
+    });
+    forward.start(link_params, receiver, 1);
+    backward.start(link_params, sender, 2);
+
+    const auto start = Clock::now();
+    auto       chunk = std::vector<std::byte>(chunk_size);
+    for(auto offset = uint64_t(0); offset < total; offset += chunk.size()) {
+        chunk.resize(std::min(uint64_t(chunk_size), total - offset));
+        for(auto i = size_t(0); i < chunk.size(); i += 1) {
+            chunk[i] = pattern(offset + i);
+        }
+        ensure(sender.write(chunk));
+    }
+    finished.wait();
+    const auto elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    sender.stop();
+    receiver.stop();
+
+    const auto stats = sender.get_stats();
+    print("transferred ", total / 1024 / 1024, " MiB in ", elapsed, " s: ", total / elapsed / 1024 / 1024, " MiB/s, ", total * 8 / elapsed / 1e6, " Mbps");
+    print("segments ", stats.segments_sent, ", retransmits ", stats.retransmits, ", timeouts ", stats.timeouts,
+          ", link drops ", forward.dropped, ", srtt ", stats.srtt.count(), " us, cwnd ", stats.cwnd);
+    ensure(!corrupted, "received data corrupted");
+    return true;
+}
+} // namespace
+
+auto main(const int argc, const char* const* const argv) -> int {
+    return run(argc, argv) ? 0 : 1;
+}
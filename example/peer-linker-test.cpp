@@ -2,6 +2,7 @@
 #include <thread>
 
 #include "macros/unwrap.hpp"
+#include "p2p/ice-agent-pool.hpp"
 #include "p2p/ice-session.hpp"
 #include "util/argument-parser.hpp"
 #include "util/file-io.hpp"
@@ -12,6 +13,8 @@ const auto server_domain     = "localhost";
 const auto server_port       = 8080;
 auto       user_cert         = std::string();
 auto       allow_self_signed = false;
+auto       mux_port          = uint16_t(0);
+auto       agent_pool        = std::unique_ptr<p2p::ice::AgentPool>();
 
 class ClientSession : public p2p::ice::IceSession {
     auto get_auth_secret() -> std::vector<std::byte> override {
@@ -32,7 +35,11 @@ auto main(const bool controlling) -> bool {
     const auto peer_linker = p2p::wss::ServerLocation{server_domain, server_port};
     const auto stun_server = p2p::wss::ServerLocation{"stun.l.google.com", 19302};
     ensure(session.start({
-                             .stun_server = stun_server,
+                             .stun_server            = stun_server,
+                             .concurrency_mode       = mux_port != 0 ? JUICE_CONCURRENCY_MODE_MUX : JUICE_CONCURRENCY_MODE_POLL,
+                             .local_port_range_begin = mux_port,
+                             .local_port_range_end   = mux_port,
+                             .agent_pool             = agent_pool.get(),
                          },
                          {
                              .peer_linker                   = peer_linker,
@@ -47,12 +54,15 @@ auto main(const bool controlling) -> bool {
 auto run(const int argc, const char* const* const argv) -> bool {
     auto role      = "both";
     auto cert_file = (const char*)(nullptr);
+    auto pool_size = uint16_t(0);
     auto help      = false;
 
     auto parser = args::Parser<uint16_t, uint8_t>();
     parser.kwarg(&help, {"-h", "--help"}, {.arg_desc = "print this help message", .state = args::State::Initialized, .no_error_check = true});
     parser.kwarg(&cert_file, {"-k"}, {"CERT_FILE", "use user certificate", args::State::Initialized});
     parser.kwarg(&allow_self_signed, {"-a"}, {"", "allow self signed ssl certificate", args::State::Initialized});
+    parser.kwarg(&mux_port, {"-m", "--mux-port"}, {"PORT", "share one udp port among all agents", args::State::Initialized});
+    parser.kwarg(&pool_size, {"-p", "--pool"}, {"N", "keep N pre-gathered agents for the client", args::State::Initialized});
     parser.kwarg(&role, {"-r", "--role"}, {"ROLE(both|server|client)", "test target", args::State::DefaultValue});
     if(!parser.parse(argc, argv) || help) {
         print("usage: peer-linker-test ", parser.get_help());
@@ -64,6 +74,14 @@ auto run(const int argc, const char* const* const argv) -> bool {
         user_cert = from_span(cert);
     }
 
+    if(pool_size != 0) {
+        agent_pool.reset(new p2p::ice::AgentPool());
+        ensure(agent_pool->start({
+            .ice  = {.stun_server = {"stun.l.google.com", 19302}},
+            .size = pool_size,
+        }));
+    }
+
     if(const auto r = std::string_view(role); r == "both") {
         auto t2 = std::thread(main, false);
         std::this_thread::sleep_for(std::chrono::seconds(1));
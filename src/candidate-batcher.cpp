@@ -0,0 +1,78 @@
+#include <algorithm>
+#include <utility>
+
+#include "candidate-batcher.hpp"
+
+namespace p2p::ice {
+auto CandidateBatcher::worker_main() -> void {
+    auto guard = std::unique_lock(lock);
+    while(true) {
+        condvar.wait(guard, [this] { return stopping || done || count > 0; });
+        if(!stopping && !done && count < max_count) {
+            condvar.wait_until(guard, first + window, [this] { return stopping || done || count >= max_count; });
+        }
+        if(stopping) {
+            return;
+        }
+        auto       lines = std::exchange(pending, {});
+        const auto last  = done;
+        count            = 0;
+        if(last) {
+            lines += end_of_candidates;
+        }
+        guard.unlock();
+        flush(std::move(lines));
+        guard.lock();
+        if(last) {
+            return;
+        }
+    }
+}
+
+auto CandidateBatcher::start(const std::chrono::milliseconds window, const size_t max_count, Flush flush) -> void {
+    stop();
+    this->window    = window;
+    this->max_count = std::max(max_count, size_t(1));
+    this->flush     = std::move(flush);
+    pending.clear();
+    count    = 0;
+    done     = false;
+    stopping = false;
+    worker   = std::thread(&CandidateBatcher::worker_main, this);
+}
+
+auto CandidateBatcher::add(const std::string_view candidate) -> void {
+    auto guard = std::lock_guard(lock);
+    if(done) {
+        return;
+    }
+    if(count == 0) {
+        first = std::chrono::steady_clock::now();
+    }
+    pending += candidate;
+    pending += '\n';
+    count += 1;
+    condvar.notify_one();
+}
+
+auto CandidateBatcher::finish() -> void {
+    auto guard = std::lock_guard(lock);
+    done       = true;
+    condvar.notify_one();
+}
+
+auto CandidateBatcher::stop() -> void {
+    {
+        auto guard = std::lock_guard(lock);
+        stopping   = true;
+        condvar.notify_one();
+    }
+    if(worker.joinable()) {
+        worker.join();
+    }
+}
+
+CandidateBatcher::~CandidateBatcher() {
+    stop();
+}
+} // namespace p2p::ice
@@ -0,0 +1,45 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+namespace p2p::ice {
+// last line of the final batch, replaces a separate GatheringDone for peers that support batches
+constexpr auto end_of_candidates = std::string_view("a=end-of-candidates");
+
+// collects trickled candidates and flushes them as newline separated lines
+// a batch is flushed when max_count candidates are collected, window has passed since its first candidate,
+// or gathering is done
+class CandidateBatcher {
+  public:
+    using Flush = std::function<void(std::string lines)>;
+
+  private:
+    Flush                                 flush;
+    std::chrono::milliseconds             window;
+    size_t                                max_count;
+    std::mutex                            lock;
+    std::condition_variable               condvar;
+    std::string                           pending;
+    size_t                                count = 0;
+    std::chrono::steady_clock::time_point first;
+    bool                                  done     = false;
+    bool                                  stopping = false;
+    std::thread                           worker;
+
+    auto worker_main() -> void;
+
+  public:
+    auto start(std::chrono::milliseconds window, size_t max_count, Flush flush) -> void;
+    auto add(std::string_view candidate) -> void;
+    auto finish() -> void;
+    // pending candidates are discarded
+    auto stop() -> void;
+
+    ~CandidateBatcher();
+};
+} // namespace p2p::ice
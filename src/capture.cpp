@@ -0,0 +1,144 @@
+#include <algorithm>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "capture.hpp"
+#include "macros/unwrap.hpp"
+#include "trace.hpp"
+
+namespace capture {
+// Writer
+auto Writer::write(const uint32_t session, const uint16_t kind, const std::span<const std::byte> payload, const std::span<const std::byte> secret) -> void {
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    const auto header  = RecordHeader{
+        .time    = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()),
+        .session = session,
+        .kind    = kind,
+        .size    = uint32_t(payload.size()),
+    };
+    constexpr auto padding = std::array<std::byte, record_alignment>();
+
+    std::fwrite(&header, sizeof(header), 1, file.get());
+    if(secret.empty()) {
+        std::fwrite(payload.data(), 1, payload.size(), file.get());
+    } else {
+        // keep the size so that length fields of the packet stay consistent
+        const auto offset = size_t(secret.data() - payload.data());
+        std::fwrite(payload.data(), 1, offset, file.get());
+        for(auto i = size_t(0); i < secret.size(); i += 1) {
+            std::fputc(0, file.get());
+        }
+        std::fwrite(payload.data() + offset + secret.size(), 1, payload.size() - offset - secret.size(), file.get());
+    }
+    std::fwrite(padding.data(), 1, padded_size(payload.size()) - payload.size(), file.get());
+    dirty = true;
+}
+
+auto Writer::open(const char* const path, const std::string_view protocol) -> bool {
+    file.reset(std::fopen(path, "wb"));
+    ensure(file, "failed to open capture file");
+    std::setvbuf(file.get(), nullptr, _IOFBF, buffer_size);
+    start      = std::chrono::steady_clock::now();
+    last_flush = start;
+
+    auto header = FileHeader{
+        .magic       = magic,
+        .version     = version,
+        .header_size = sizeof(FileHeader),
+        .protocol    = {},
+        .start_time  = p2p::trace::now(),
+    };
+    std::memcpy(header.protocol.data(), protocol.data(), std::min(protocol.size(), header.protocol.size() - 1));
+    ensure(std::fwrite(&header, sizeof(header), 1, file.get()) == 1);
+    return true;
+}
+
+auto Writer::is_open() const -> bool {
+    return bool(file);
+}
+
+auto Writer::flush() -> void {
+    if(!dirty) {
+        return;
+    }
+    if(const auto now = std::chrono::steady_clock::now(); now - last_flush >= flush_interval) {
+        std::fflush(file.get());
+        last_flush = now;
+        dirty      = false;
+    }
+}
+
+auto Writer::on_open(const void* const session) -> void {
+    const auto id = next_session += 1;
+    sessions[session] = id;
+    write(id, RecordKind::Open, {});
+}
+
+auto Writer::on_frame(const void* const session, const std::span<const std::byte> payload, const std::span<const std::byte> secret) -> void {
+    if(const auto it = sessions.find(session); it != sessions.end()) {
+        write(it->second, RecordKind::Frame, payload, secret);
+    }
+}
+
+auto Writer::on_close(const void* const session) -> void {
+    if(const auto it = sessions.find(session); it != sessions.end()) {
+        write(it->second, RecordKind::Close, {});
+        sessions.erase(it);
+    }
+}
+
+// Reader
+auto Reader::open(const char* const path) -> bool {
+    const auto fd = ::open(path, O_RDONLY);
+    ensure(fd >= 0, "failed to open capture file");
+    struct stat st = {};
+    if(fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(FileHeader)) {
+        close(fd);
+        bail("capture file too short");
+    }
+    const auto ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    ensure(ptr != MAP_FAILED, "failed to map capture file");
+    data   = static_cast<const std::byte*>(ptr);
+    size   = st.st_size;
+    cursor = sizeof(FileHeader);
+
+    const auto& header = get_header();
+    ensure(header.magic == magic, "not a capture file");
+    ensure(header.version == version, "unsupported capture version ", header.version);
+    ensure(header.header_size == sizeof(FileHeader));
+    madvise(const_cast<std::byte*>(data), size, MADV_SEQUENTIAL);
+    return true;
+}
+
+auto Reader::get_header() const -> const FileHeader& {
+    return *std::bit_cast<const FileHeader*>(data);
+}
+
+auto Reader::next() -> std::optional<Record> {
+    if(cursor >= size) {
+        return std::nullopt;
+    }
+    ensure(cursor + sizeof(RecordHeader) <= size, "truncated record");
+    const auto header = std::bit_cast<const RecordHeader*>(data + cursor);
+    ensure(header->kind < RecordKind::Limit, "corrupted record");
+    const auto payload_offset = cursor + sizeof(RecordHeader);
+    ensure(payload_offset + header->size <= size, "truncated record");
+    cursor = payload_offset + padded_size(header->size);
+    return Record{header, {data + payload_offset, header->size}};
+}
+
+auto Reader::rewind() -> void {
+    cursor = sizeof(FileHeader);
+}
+
+Reader::~Reader() {
+    if(data != nullptr) {
+        munmap(const_cast<std::byte*>(data), size);
+    }
+}
+} // namespace capture
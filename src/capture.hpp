@@ -0,0 +1,103 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <unordered_map>
+
+#include "macros/autoptr.hpp"
+
+// append-only recording of received frames
+// file: FileHeader, then records of RecordHeader + payload padded to record_alignment
+namespace capture {
+declare_autoptr(CaptureFile, FILE, fclose);
+
+constexpr auto magic            = std::array<char, 8>{'P', '2', 'P', 'C', 'A', 'P', '\0', '\0'};
+constexpr auto version          = uint32_t(1);
+constexpr auto record_alignment = size_t(8);
+constexpr auto buffer_size      = size_t(1024 * 1024);
+constexpr auto flush_interval   = std::chrono::seconds(1);
+
+struct FileHeader {
+    std::array<char, 8>  magic;
+    uint32_t             version;
+    uint32_t             header_size; // sizeof(FileHeader)
+    std::array<char, 16> protocol;    // null terminated
+    int64_t              start_time;  // unix time in microseconds
+};
+static_assert(sizeof(FileHeader) == 40);
+
+struct RecordKind {
+    enum : uint16_t {
+        Open,  // connection established, no payload
+        Frame, // payload received from the connection
+        Close, // connection closed, no payload
+
+        Limit,
+    };
+};
+
+struct RecordHeader {
+    uint64_t time;    // monotonic, nanoseconds since the capture started
+    uint32_t session; // unique in the file
+    uint16_t kind;
+    uint16_t reserved;
+    uint32_t size; // of payload, excluding padding
+    uint32_t reserved2;
+};
+static_assert(sizeof(RecordHeader) == 24);
+
+inline auto padded_size(const size_t size) -> size_t {
+    return (size + record_alignment - 1) & ~(record_alignment - 1);
+}
+
+class Writer {
+  private:
+    AutoCaptureFile                           file;
+    std::chrono::steady_clock::time_point     start;
+    std::chrono::steady_clock::time_point     last_flush;
+    std::unordered_map<const void*, uint32_t> sessions; // session data -> id
+    uint32_t                                  next_session = 0;
+    bool                                      dirty        = false; // written since the last flush
+
+    auto write(uint32_t session, uint16_t kind, std::span<const std::byte> payload, std::span<const std::byte> secret = {}) -> void;
+
+  public:
+    auto open(const char* path, std::string_view protocol) -> bool;
+    auto is_open() const -> bool;
+    // cheap to call often, the file is flushed when its buffer fills or once per flush_interval
+    auto flush() -> void;
+
+    auto on_open(const void* session) -> void;
+    // secret: part of payload written as zeros, e.g. certificates
+    auto on_frame(const void* session, std::span<const std::byte> payload, std::span<const std::byte> secret = {}) -> void;
+    auto on_close(const void* session) -> void;
+};
+
+struct Record {
+    const RecordHeader*        header;
+    std::span<const std::byte> payload;
+};
+
+// maps the whole capture file
+class Reader {
+  private:
+    const std::byte* data   = nullptr;
+    size_t           size   = 0;
+    size_t           cursor = 0;
+
+  public:
+    auto open(const char* path) -> bool;
+    auto get_header() const -> const FileHeader&;
+    // nullopt at the end or on truncated records
+    auto next() -> std::optional<Record>;
+    auto rewind() -> void;
+
+    Reader() = default;
+    Reader(const Reader&) = delete;
+    ~Reader();
+};
+} // namespace capture
@@ -1,5 +1,7 @@
 #include "channel-hub-protocol.hpp"
+#include "logger.hpp"
 #include "macros/unwrap.hpp"
+#include "metrics.hpp"
 #include "server.hpp"
 #include "util/string-map.hpp"
 
@@ -22,6 +24,9 @@ struct Error {
         SenderMismatch,
         AnotherRequestPending,
         RequesterNotFound,
+        Overloaded,
+        ChannelQuota,
+        RequestQuota,
 
         Limit,
     };
@@ -35,6 +40,9 @@ const auto estr = std::array{
     "channel not registered by the sender",      // SenderMismatch
     "another request in progress",               // AnotherRequestPending
     "requester not found",                       // RequesterNotFound
+    "server overloaded",                         // Overloaded
+    "too many channels of user",                 // ChannelQuota
+    "too many pending requests of user",         // RequestQuota
 };
 
 static_assert(Error::Limit == estr.size());
@@ -49,56 +57,81 @@ struct ChannelHubSession : Session {
 struct PendingRequest {
     ChannelHubSession* requester;
     ChannelHubSession* requestee;
+    Timer              timer;
 };
 
 struct ChannelHub : Server {
     StringMap<Channel>                           channels;
     std::unordered_map<uint32_t, PendingRequest> pending_requests;
     uint32_t                                     packet_id;
+
+    auto erase_channel(StringMap<Channel>::iterator it) -> StringMap<Channel>::iterator;
+    auto erase_request(std::unordered_map<uint32_t, PendingRequest>::iterator it) -> std::unordered_map<uint32_t, PendingRequest>::iterator;
 };
 
+auto ChannelHub::erase_channel(const StringMap<Channel>::iterator it) -> StringMap<Channel>::iterator {
+    release_quota(it->second.session->user, &User::channels);
+    metrics::add(metrics::Metric::Channels, -1);
+    return channels.erase(it);
+}
+
+auto ChannelHub::erase_request(const std::unordered_map<uint32_t, PendingRequest>::iterator it) -> std::unordered_map<uint32_t, PendingRequest>::iterator {
+    release_quota(it->second.requester->user, &User::pending_requests);
+    metrics::add(metrics::Metric::PendingRequests, -1);
+    return pending_requests.erase(it);
+}
+
 auto ChannelHubSession::handle_payload(const std::span<const std::byte> payload) -> bool {
-    unwrap(header, p2p::proto::extract_header(payload));
+    log_unwrap(header, p2p::proto::extract_header(payload));
 
     if(header.type == ::p2p::proto::Type::ActivateSession) {
         const auto cert = p2p::proto::extract_last_string<proto::Register>(payload);
-        print("received activate session");
-        ensure(activate(*server, cert), "failed to verify user certificate");
-        print("session activated");
+        log_debug("received activate session");
+        log_ensure(activate(*server, cert), "failed to verify user certificate");
+        log_info("session activated");
         goto finish;
     } else {
-        ensure(activated, estr[Error::NotActivated]);
+        log_ensure(activated, estr[Error::NotActivated]);
     }
 
     switch(header.type) {
     case ::p2p::proto::Type::Success:
     case ::p2p::proto::Type::Error:
-        line_warn("unexpected packet");
+        log_warn("unexpected packet");
         return true;
     case proto::Type::Register: {
         const auto name = p2p::proto::extract_last_string<proto::Register>(payload);
-        print("received channel register request name:", name);
+        log_debug("received channel register request name:", name);
 
-        ensure(!name.empty(), estr[Error::EmptyChannelName]);
-        ensure(server->channels.find(name) == server->channels.end(), estr[Error::ChannelFound]);
+        log_ensure(!name.empty(), estr[Error::EmptyChannelName]);
+        log_ensure(server->channels.find(name) == server->channels.end(), estr[Error::ChannelFound]);
+        if(!server->admit(metrics::Metric::ShedRegistrations)) {
+            error_code = ::p2p::proto::ErrorCode::Overloaded;
+            log_bail(estr[Error::Overloaded]);
+        }
+        if(!server->acquire_quota(user, &User::channels, &UserLimits::channels)) {
+            error_code = ::p2p::proto::ErrorCode::ChannelQuota;
+            log_bail(estr[Error::ChannelQuota]);
+        }
 
-        print("channel ", name, " registerd");
+        log_info("channel ", name, " registerd");
         server->channels.insert(std::pair{name, Channel{std::string(name), this}});
+        metrics::add(metrics::Metric::Channels);
     } break;
     case proto::Type::Unregister: {
         const auto name = p2p::proto::extract_last_string<proto::Unregister>(payload);
-        print("received channel unregister request name: ", name);
+        log_debug("received channel unregister request name: ", name);
 
         const auto it = server->channels.find(name);
-        ensure(it != server->channels.end(), estr[Error::ChannelNotFound]);
+        log_ensure(it != server->channels.end(), estr[Error::ChannelNotFound]);
         auto& channel = it->second;
-        ensure(channel.session == this, estr[Error::SenderMismatch]);
+        log_ensure(channel.session == this, estr[Error::SenderMismatch]);
 
-        print("unregistering channel ", channel.name);
-        server->channels.erase(it);
+        log_info("unregistering channel ", channel.name);
+        server->erase_channel(it);
     } break;
     case proto::Type::GetChannels: {
-        print("received channel list request");
+        log_debug("received channel list request");
         auto payload = std::vector<std::byte>();
         for(auto it = server->channels.begin(); it != server->channels.end(); it = std::next(it)) {
             const auto& name      = it->second.name;
@@ -107,47 +140,64 @@ auto ChannelHubSession::handle_payload(const std::span<const std::byte> payload)
             std::memcpy(payload.data() + prev_size, name.data(), name.size() + 1);
         }
 
-        ensure(server->send_to(wsi, proto::Type::GetChannelsResponse, header.id, payload));
+        log_ensure(server->send_to(wsi, proto::Type::GetChannelsResponse, header.id, payload));
         return true;
     } break;
     case proto::Type::PadRequest: {
         const auto name = p2p::proto::extract_last_string<proto::PadRequest>(payload);
-        print("received pad request for channel: ", name);
+        log_debug("received pad request for channel: ", name);
 
         // check if another request is pending
         for(auto i = server->pending_requests.begin(); i != server->pending_requests.end(); i = std::next(i)) {
-            ensure(i->second.requester != this, estr[Error::AnotherRequestPending]);
+            log_ensure(i->second.requester != this, estr[Error::AnotherRequestPending]);
         }
 
         const auto it = server->channels.find(name);
-        ensure(it != server->channels.end(), estr[Error::ChannelNotFound]);
+        log_ensure(it != server->channels.end(), estr[Error::ChannelNotFound]);
         auto& channel = it->second;
+        if(!server->acquire_quota(user, &User::pending_requests, &UserLimits::pending_requests)) {
+            error_code = ::p2p::proto::ErrorCode::RequestQuota;
+            log_bail(estr[Error::RequestQuota]);
+        }
 
         const auto id = server->packet_id += 1;
-        ensure(server->send_to(channel.session->wsi, proto::Type::PadRequest, id, name));
-        server->pending_requests.insert({id, PendingRequest{.requester = this, .requestee = channel.session}});
+        if(!server->send_to(channel.session->wsi, proto::Type::PadRequest, id, name)) {
+            server->release_quota(user, &User::pending_requests);
+            return false;
+        }
+        auto& request     = server->pending_requests.try_emplace(id).first->second;
+        request.requester = this;
+        request.requestee = channel.session;
+        metrics::add(metrics::Metric::PendingRequests);
+        if(server->pad_request_timeout.count() > 0) {
+            server->timers.arm(request.timer, server->pad_request_timeout, [server = server, id, requester = this] {
+                log_info("pad request ", id, " timed out");
+                server->erase_request(server->pending_requests.find(id));
+                server->send_to(requester->wsi, proto::Type::PadRequestResponse, 0, uint16_t(0));
+            });
+        }
     } break;
     case proto::Type::PadRequestResponse: {
-        print("received pad request response");
+        log_debug("received pad request response");
 
-        unwrap(packet, p2p::proto::extract_payload<proto::PadRequestResponse>(payload));
+        log_unwrap(packet, p2p::proto::extract_payload<proto::PadRequestResponse>(payload));
         const auto pad_name = p2p::proto::extract_last_string<proto::PadRequestResponse>(payload);
 
         const auto request_it = server->pending_requests.find(header.id);
-        ensure(request_it != server->pending_requests.end(), estr[Error::RequesterNotFound]);
-        const auto request = request_it->second;
-        server->pending_requests.erase(request_it);
+        log_ensure(request_it != server->pending_requests.end(), estr[Error::RequesterNotFound]);
+        const auto requester = request_it->second.requester;
+        server->erase_request(request_it);
 
-        print("sending pad name ok: ", packet.ok, " pad_name: ", pad_name);
-        ensure(server->send_to(request.requester->wsi, proto::Type::PadRequestResponse, 0, packet.ok, pad_name));
+        log_info("sending pad name ok: ", packet.ok, " pad_name: ", pad_name);
+        log_ensure(server->send_to(requester->wsi, proto::Type::PadRequestResponse, 0, packet.ok, pad_name));
     } break;
     default: {
-        bail("unknown command ", int(header.type));
+        log_bail("unknown command ", int(header.type));
     }
     }
 
 finish:
-    ensure(server->send_to(wsi, ::p2p::proto::Type::Success, header.id));
+    log_ensure(server->send_to(wsi, ::p2p::proto::Type::Success, header.id));
     return true;
 }
 
@@ -158,44 +208,48 @@ struct SessionDataInitializer : ws::server::SessionDataInitializer {
         auto& session  = *(new ChannelHubSession());
         session.server = server;
         session.wsi    = wsi;
-        print("session created: ", &session);
+        log_info("session created: ", &session);
+        metrics::add(metrics::Metric::Sessions);
         return &session;
     }
 
     auto free(void* const ptr) -> void override {
         auto& session = *std::bit_cast<ChannelHubSession*>(ptr);
+        server->close_outbox(session.wsi);
 
         // remove corresponding channels
         auto& channels = server->channels;
-        for(auto i = channels.begin(); i != channels.end(); i = std::next(i)) {
+        for(auto i = channels.begin(); i != channels.end();) {
             const auto& channel = i->second;
             if(channel.session == &session) {
-                print("unregistering channel ", channel.name);
-                channels.erase(i);
-                break;
+                log_info("unregistering channel ", channel.name);
+                i = server->erase_channel(i);
+            } else {
+                i = std::next(i);
             }
         }
 
         // remove from pending list
         auto& requests = server->pending_requests;
-        for(auto i = requests.begin(); i != requests.end(); i = std::next(i)) {
+        for(auto i = requests.begin(); i != requests.end();) {
             const auto& request = i->second;
             if(request.requester == &session) {
                 // pad requester has gone.
                 // delete request
-                requests.erase(i);
-                break;
+                i = server->erase_request(i);
             } else if(request.requestee == &session) {
                 // pad requestee has gone.
                 // delete request and send fail to requester
                 server->send_to(request.requester->wsi, proto::Type::PadRequestResponse, 0, uint16_t(0));
-                requests.erase(i);
-                break;
+                i = server->erase_request(i);
+            } else {
+                i = std::next(i);
             }
         }
 
         delete &session;
-        print("session destroyed: ", &session);
+        log_info("session destroyed: ", &session);
+        metrics::add(metrics::Metric::Sessions, -1);
     }
 
     SessionDataInitializer(ChannelHub& server)
@@ -0,0 +1,171 @@
+#include <algorithm>
+#include <cstring>
+
+#include "channel-mux.hpp"
+
+namespace p2p::ice {
+namespace {
+constexpr auto header_size = size_t(2); // kind, channel id
+constexpr auto max_burst   = std::chrono::milliseconds(2);
+constexpr auto min_burst   = 1500.0; // bytes, so that any datagram can be sent eventually
+} // namespace
+
+auto ChannelMux::build_datagram(const uint8_t id, const std::span<const std::byte> payload) const -> std::vector<std::byte> {
+    auto datagram = std::vector<std::byte>(header_size + payload.size());
+    datagram[0]   = std::byte(kind);
+    datagram[1]   = std::byte(id);
+    std::memcpy(datagram.data() + header_size, payload.data(), payload.size());
+    return datagram;
+}
+
+auto ChannelMux::pick() -> size_t {
+    auto best = channels.size();
+    for(auto i = size_t(0); i < channels.size(); i += 1) {
+        // start after the last served channel for round robin among equal priorities
+        const auto index   = (round_robin + 1 + i) % channels.size();
+        const auto channel = channels[index].get();
+        if(channel == nullptr || channel->queue.empty()) {
+            continue;
+        }
+        if(best == channels.size() || channel->params.priority < channels[best]->params.priority) {
+            best = index;
+        }
+    }
+    return best;
+}
+
+auto ChannelMux::worker_main() -> void {
+    const auto burst = std::max(min_burst, rate * std::chrono::duration<double>(max_burst).count());
+    auto       guard = std::unique_lock(lock);
+    while(!stopping) {
+        if(queued_datagrams == 0) {
+            condvar.wait(guard);
+            continue;
+        }
+        const auto now = Clock::now();
+        tokens         = std::min(burst, tokens + rate * std::chrono::duration<double>(now - last_refill).count());
+        last_refill    = now;
+
+        const auto index   = pick();
+        const auto channel = channels[index].get();
+        const auto size    = channel->queue.front().size();
+        // datagrams larger than a burst go into debt
+        if(const auto needed = std::min(double(size), burst); tokens < needed) {
+            condvar.wait_for(guard, std::chrono::duration<double>((needed - tokens) / rate));
+            continue;
+        }
+        tokens -= size;
+        round_robin = index;
+        auto datagram = std::move(channel->queue.front());
+        channel->queue.pop_front();
+        channel->stats.queued -= datagram.size() - header_size;
+        channel->stats.sent += 1;
+        queued_datagrams -= 1;
+        guard.unlock();
+        transmit(datagram);
+        guard.lock();
+    }
+}
+
+auto ChannelMux::start(const uint64_t rate, const uint8_t kind, Transmit transmit) -> void {
+    this->rate     = rate;
+    this->kind     = kind;
+    this->transmit = std::move(transmit);
+    if(rate != 0) {
+        last_refill = Clock::now();
+        worker      = std::thread(&ChannelMux::worker_main, this);
+    }
+}
+
+auto ChannelMux::stop() -> void {
+    {
+        auto guard = std::lock_guard(lock);
+        stopping   = true;
+        condvar.notify_all();
+    }
+    if(worker.joinable()) {
+        worker.join();
+    }
+}
+
+auto ChannelMux::open(const uint8_t id, ChannelParams params) -> bool {
+    auto guard = std::lock_guard(lock);
+    if(channels[id]) {
+        return false;
+    }
+    channels[id].reset(new Channel{.params = std::move(params)});
+    return true;
+}
+
+auto ChannelMux::close(const uint8_t id) -> void {
+    auto guard = std::lock_guard(lock);
+    if(const auto& channel = channels[id]) {
+        queued_datagrams -= channel->queue.size();
+        channels[id].reset();
+    }
+}
+
+auto ChannelMux::send(const uint8_t id, const std::span<const std::byte> payload) -> bool {
+    auto datagram = build_datagram(id, payload);
+
+    auto guard   = std::unique_lock(lock);
+    auto channel = channels[id].get();
+    if(channel == nullptr) {
+        return false;
+    }
+    if(rate == 0) {
+        channel->stats.sent += 1;
+        guard.unlock();
+        return transmit(datagram);
+    }
+
+    auto& params = channel->params;
+    auto& stats  = channel->stats;
+    if(stats.queued + payload.size() > params.queue_limit) {
+        if(params.drop_policy == DropPolicy::DropNewest) {
+            stats.dropped += 1;
+            return false;
+        }
+        while(!channel->queue.empty() && stats.queued + payload.size() > params.queue_limit) {
+            stats.queued -= channel->queue.front().size() - header_size;
+            stats.dropped += 1;
+            channel->queue.pop_front();
+            queued_datagrams -= 1;
+        }
+    }
+    channel->queue.push_back(std::move(datagram));
+    stats.queued += payload.size();
+    queued_datagrams += 1;
+    condvar.notify_one();
+    return true;
+}
+
+auto ChannelMux::on_datagram(const std::span<const std::byte> datagram) -> void {
+    if(datagram.size() < header_size) {
+        return;
+    }
+    auto callback = std::function<void(std::span<const std::byte>)>();
+    {
+        auto  guard   = std::lock_guard(lock);
+        auto& channel = channels[uint8_t(datagram[1])];
+        if(!channel || !channel->params.on_received) {
+            return;
+        }
+        channel->stats.received += 1;
+        callback = channel->params.on_received;
+    }
+    callback(datagram.subspan(header_size));
+}
+
+auto ChannelMux::get_stats(const uint8_t id) -> std::optional<ChannelStats> {
+    auto guard = std::lock_guard(lock);
+    if(!channels[id]) {
+        return std::nullopt;
+    }
+    return channels[id]->stats;
+}
+
+ChannelMux::~ChannelMux() {
+    stop();
+}
+} // namespace p2p::ice
@@ -0,0 +1,83 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <thread>
+#include <vector>
+
+namespace p2p::ice {
+struct DropPolicy {
+    enum : uint8_t {
+        DropOldest, // keep the latest messages, for state updates and media
+        DropNewest, // keep the queued messages, for control
+    };
+};
+
+struct ChannelParams {
+    uint8_t                                          priority    = 0; // lower is served first
+    uint8_t                                          drop_policy = DropPolicy::DropOldest;
+    size_t                                           queue_limit = 256 * 1024; // bytes waiting for the scheduler
+    std::function<void(std::span<const std::byte>)> on_received;
+};
+
+struct ChannelStats {
+    uint64_t sent     = 0;
+    uint64_t received = 0;
+    uint64_t dropped  = 0; // by the queue limit
+    size_t   queued   = 0; // bytes
+};
+
+// logical channels sharing one datagram path
+// each datagram carries the channel id after the kind byte
+// with a rate set, messages are queued per channel and sent in priority order, round robin within a priority,
+// so that bulk channels cannot delay urgent ones behind them
+class ChannelMux {
+  public:
+    using Transmit = std::function<bool(std::span<const std::byte> datagram)>;
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Channel {
+        ChannelParams                      params;
+        std::deque<std::vector<std::byte>> queue; // datagrams
+        ChannelStats                       stats;
+    };
+
+    Transmit                                  transmit;
+    uint8_t                                   kind;
+    uint64_t                                  rate = 0; // bytes per second, 0 to send immediately
+    std::mutex                                lock;
+    std::condition_variable                   condvar;
+    std::array<std::unique_ptr<Channel>, 256> channels;
+    size_t                                    queued_datagrams = 0;
+    size_t                                    round_robin      = 0;
+    double                                    tokens           = 0; // bytes
+    Clock::time_point                         last_refill;
+    std::thread                               worker;
+    bool                                      stopping = false;
+
+    auto build_datagram(uint8_t id, std::span<const std::byte> payload) const -> std::vector<std::byte>;
+    // index of the channel to serve next, channels.size() if nothing is queued
+    auto pick() -> size_t;
+    auto worker_main() -> void;
+
+  public:
+    auto start(uint64_t rate, uint8_t kind, Transmit transmit) -> void;
+    auto stop() -> void;
+    auto open(uint8_t id, ChannelParams params) -> bool;
+    auto close(uint8_t id) -> void;
+    // false if the channel is not open or the message was dropped
+    auto send(uint8_t id, std::span<const std::byte> payload) -> bool;
+    auto on_datagram(std::span<const std::byte> datagram) -> void;
+    auto get_stats(uint8_t id) -> std::optional<ChannelStats>;
+
+    ~ChannelMux();
+};
+} // namespace p2p::ice
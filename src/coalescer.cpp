@@ -0,0 +1,115 @@
+#include <cstring>
+#include <limits>
+
+#include "coalescer.hpp"
+
+namespace p2p::ice {
+namespace {
+using Size = uint16_t;
+} // namespace
+
+auto Coalescer::flush_pending() -> bool {
+    if(pending.size() <= 1) {
+        return true;
+    }
+    const auto result = transmit(pending);
+    pending.resize(1);
+    stats.datagrams += 1;
+    return result;
+}
+
+auto Coalescer::worker_main() -> void {
+    auto guard = std::unique_lock(lock);
+    while(true) {
+        condvar.wait(guard, [this] { return stopping || pending.size() > 1; });
+        if(stopping) {
+            return;
+        }
+        if(Clock::now() < first + budget) {
+            // woken early by stop or by a flush from send
+            condvar.wait_until(guard, first + budget);
+            continue;
+        }
+        flush_pending();
+    }
+}
+
+auto Coalescer::start(const std::chrono::microseconds budget, const size_t max_size, const uint8_t kind, Transmit transmit) -> void {
+    stop();
+    this->budget   = budget;
+    this->max_size = max_size;
+    this->kind     = kind;
+    this->transmit = std::move(transmit);
+    pending.assign(1, std::byte(kind));
+    pending.reserve(max_size);
+    stats    = {};
+    stopping = false;
+    worker   = std::thread(&Coalescer::worker_main, this);
+}
+
+auto Coalescer::stop() -> void {
+    {
+        auto guard = std::lock_guard(lock);
+        stopping   = true;
+        condvar.notify_one();
+    }
+    if(worker.joinable()) {
+        worker.join();
+    }
+}
+
+auto Coalescer::send(const std::span<const std::byte> message) -> bool {
+    if(message.size() > std::numeric_limits<Size>::max()) {
+        return false;
+    }
+    const auto frame_size = sizeof(Size) + message.size();
+
+    auto guard  = std::lock_guard(lock);
+    auto result = true;
+    if(pending.size() + frame_size > max_size) {
+        result = flush_pending();
+    }
+    if(pending.size() == 1) {
+        first = Clock::now();
+        condvar.notify_one();
+    }
+    const auto size   = Size(message.size());
+    const auto offset = pending.size();
+    pending.resize(offset + frame_size);
+    std::memcpy(pending.data() + offset, &size, sizeof(Size));
+    std::memcpy(pending.data() + offset + sizeof(Size), message.data(), message.size());
+    stats.messages += 1;
+    // larger than max_size by itself, or nothing else fits
+    if(pending.size() + sizeof(Size) >= max_size) {
+        result &= flush_pending();
+    }
+    return result;
+}
+
+auto Coalescer::get_stats() -> CoalesceStats {
+    auto guard = std::lock_guard(lock);
+    return stats;
+}
+
+auto Coalescer::split(std::span<const std::byte> datagram, const OnMessage& on_message) -> bool {
+    datagram = datagram.subspan(1);
+    while(!datagram.empty()) {
+        auto size = Size();
+        if(datagram.size() < sizeof(Size)) {
+            return false;
+        }
+        std::memcpy(&size, datagram.data(), sizeof(Size));
+        datagram = datagram.subspan(sizeof(Size));
+        if(datagram.size() < size) {
+            return false;
+        }
+        on_message(datagram.subspan(0, size));
+        datagram = datagram.subspan(size);
+    }
+    return true;
+}
+
+Coalescer::~Coalescer() {
+    stop();
+}
+} // namespace p2p::ice
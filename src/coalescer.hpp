@@ -0,0 +1,61 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+namespace p2p::ice {
+struct CoalesceStats {
+    uint64_t messages  = 0;
+    uint64_t datagrams = 0;
+
+    // messages per datagram
+    auto ratio() const -> double {
+        return datagrams == 0 ? 0.0 : double(messages) / datagrams;
+    }
+};
+
+// packs small messages into datagrams of up to max_size bytes
+// a datagram is [kind]([uint16 size][message])..., sent when the next message does not fit
+// or budget has passed since its first message
+class Coalescer {
+  public:
+    using Transmit  = std::function<bool(std::span<const std::byte> datagram)>;
+    using OnMessage = std::function<void(std::span<const std::byte> message)>;
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    Transmit                  transmit;
+    uint8_t                   kind;
+    size_t                    max_size;
+    std::chrono::microseconds budget;
+    std::mutex                lock;
+    std::condition_variable   condvar;
+    std::vector<std::byte>    pending;
+    Clock::time_point         first;
+    bool                      stopping = false;
+    std::thread               worker;
+    CoalesceStats             stats;
+
+    // lock must be held, transmits under it to keep datagrams in order
+    auto flush_pending() -> bool;
+    auto worker_main() -> void;
+
+  public:
+    auto start(std::chrono::microseconds budget, size_t max_size, uint8_t kind, Transmit transmit) -> void;
+    // pending messages are discarded
+    auto stop() -> void;
+    // false if the message is larger than 64KiB or a datagram could not be sent
+    auto send(std::span<const std::byte> message) -> bool;
+    auto get_stats() -> CoalesceStats;
+
+    // false if the datagram is malformed, messages before the error are still passed
+    static auto split(std::span<const std::byte> datagram, const OnMessage& on_message) -> bool;
+
+    ~Coalescer();
+};
+} // namespace p2p::ice
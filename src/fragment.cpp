@@ -0,0 +1,129 @@
+#include <algorithm>
+#include <random>
+
+#include "fragment.hpp"
+#include "macros/unwrap.hpp"
+#include "protocol-helper.hpp"
+
+// fragments come from the network, servers report malformed ones through the logger instead of blocking on stderr
+#if defined(P2P_SERVER)
+#include "logger.hpp"
+#define input_ensure log_ensure
+#define input_unwrap log_unwrap
+#else
+#define input_ensure ensure
+#define input_unwrap unwrap
+#endif
+
+namespace p2p::proto {
+namespace {
+constexpr auto max_fragment_data = max_packet_size - sizeof(Fragment);
+} // namespace
+
+auto issue_fragment_id() -> uint32_t {
+    thread_local auto random = std::mt19937(std::random_device()());
+    return random();
+}
+
+auto for_each_fragment(const std::span<const std::byte> packet, const std::function<bool(std::span<const std::byte>)>& send) -> bool {
+    if(packet.size() <= max_packet_size) {
+        return send(packet);
+    }
+    const auto id       = issue_fragment_id();
+    auto       fragment = std::vector<std::byte>();
+    fragment.reserve(max_packet_size);
+    for(auto offset = size_t(0); offset < packet.size(); offset += max_fragment_data) {
+        const auto data = packet.subspan(offset, std::min(max_fragment_data, packet.size() - offset));
+        fragment.resize(sizeof(Fragment) + data.size());
+        *std::bit_cast<Fragment*>(fragment.data()) = Fragment{
+            {uint16_t(fragment.size()), Type::Fragment, id},
+            uint32_t(packet.size()),
+            uint32_t(offset),
+        };
+        std::memcpy(fragment.data() + sizeof(Fragment), data.data(), data.size());
+        ensure(send(fragment));
+    }
+    return true;
+}
+
+auto BufferPool::acquire() -> std::vector<std::byte> {
+    if(free.empty()) {
+        return {};
+    }
+    auto buffer = std::move(free.back());
+    free.pop_back();
+    return buffer;
+}
+
+auto BufferPool::grow(std::vector<std::byte>& buffer, const std::span<const std::byte> data, const size_t total_size) -> bool {
+    input_ensure(in_use + data.size() <= limits.max_total_size, "too many packets being reassembled");
+    in_use += data.size();
+    // doubled up to the packet size, not beyond
+    if(const auto size = buffer.size() + data.size(); size > buffer.capacity()) {
+        buffer.reserve(std::min(std::max(size, buffer.capacity() * 2), total_size));
+    }
+    buffer.insert(buffer.end(), data.begin(), data.end());
+    return true;
+}
+
+auto BufferPool::release(std::vector<std::byte> buffer) -> void {
+    in_use -= buffer.size();
+    buffer.clear();
+    if(free.size() < limits.max_pooled && buffer.capacity() <= limits.max_packet_size) {
+        free.emplace_back(std::move(buffer));
+    }
+}
+
+auto Reassembler::drop(const std::vector<Pending>::iterator it) -> void {
+    pending_size -= it->total_size;
+    pool->release(std::move(it->buffer));
+    pending.erase(it);
+}
+
+auto Reassembler::feed(BufferPool& pool, const std::span<const std::byte> fragment, const std::function<bool(std::span<const std::byte>)>& on_packet) -> bool {
+    this->pool = &pool;
+    input_unwrap(header, extract_payload<Fragment>(fragment));
+    const auto data = fragment.subspan(sizeof(Fragment));
+    input_ensure(header.total_size > max_packet_size && header.offset + data.size() <= header.total_size, "malformed fragment");
+
+    auto it = std::ranges::find_if(pending, [id = header.id](const Pending& p) { return p.id == id; });
+    if(it == pending.end()) {
+        if(header.offset != 0) {
+            // the head of the packet was dropped
+            return true;
+        }
+        input_ensure(header.total_size <= pool.limits.max_packet_size, "packet too large to reassemble: ", header.total_size);
+        while(!pending.empty() && (pending.size() >= pool.limits.max_pending || pending_size + header.total_size > pool.limits.max_connection_size)) {
+            drop(pending.begin());
+        }
+        pending.push_back(Pending{.id = header.id, .total_size = header.total_size, .buffer = pool.acquire()});
+        pending_size += header.total_size;
+        it = std::prev(pending.end());
+    }
+    if(header.offset != it->buffer.size() || header.total_size != it->total_size) {
+        // a fragment in the middle was dropped
+        drop(it);
+        return true;
+    }
+    if(!pool.grow(it->buffer, data, it->total_size)) {
+        drop(it);
+        return false;
+    }
+    if(it->buffer.size() < it->total_size) {
+        return true;
+    }
+
+    auto buffer = std::move(it->buffer);
+    pending_size -= it->total_size;
+    pending.erase(it);
+    const auto result = on_packet(buffer);
+    pool.release(std::move(buffer));
+    return result;
+}
+
+Reassembler::~Reassembler() {
+    for(auto& p : pending) {
+        pool->release(std::move(p.buffer));
+    }
+}
+} // namespace p2p::proto
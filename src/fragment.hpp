@@ -0,0 +1,62 @@
+#pragma once
+#include <functional>
+#include <span>
+#include <vector>
+
+#include "protocol.hpp"
+
+namespace p2p::proto {
+struct ReassemblyLimits {
+    size_t max_packet_size     = 16 * 1024 * 1024;
+    size_t max_total_size      = 64 * 1024 * 1024; // received bytes of all packets being reassembled with a pool
+    size_t max_connection_size = 16 * 1024 * 1024; // declared sizes of packets being reassembled per connection, the oldest is dropped
+    size_t max_pending         = 4;                // packets being reassembled or relayed per connection, the oldest is dropped
+    size_t max_pooled          = 4;                // free buffers kept for reuse
+};
+
+// random, see Fragment
+auto issue_fragment_id() -> uint32_t;
+
+// calls send with each fragment of a packet larger than max_packet_size, or with the packet itself
+auto for_each_fragment(std::span<const std::byte> packet, const std::function<bool(std::span<const std::byte>)>& send) -> bool;
+
+// reassembly buffers shared by connections, not thread safe
+class BufferPool {
+  private:
+    std::vector<std::vector<std::byte>> free;
+    size_t                              in_use = 0; // bytes
+
+  public:
+    ReassemblyLimits limits;
+
+    // empty buffer, with capacity if reused
+    auto acquire() -> std::vector<std::byte>;
+    // appends data to a buffer of a packet of total_size bytes, false over max_total_size
+    auto grow(std::vector<std::byte>& buffer, std::span<const std::byte> data, size_t total_size) -> bool;
+    auto release(std::vector<std::byte> buffer) -> void;
+};
+
+// reassembles fragments received from one connection
+// a packet missing a fragment, e.g. dropped by a relay, is discarded
+class Reassembler {
+  private:
+    struct Pending {
+        uint32_t               id;
+        size_t                 total_size;
+        std::vector<std::byte> buffer; // grows as fragments arrive
+    };
+
+    BufferPool*          pool = nullptr;
+    std::vector<Pending> pending;          // oldest first
+    size_t               pending_size = 0; // sum of total_size
+
+    auto drop(std::vector<Pending>::iterator it) -> void;
+
+  public:
+    // on_packet is called with the whole packet once its last fragment arrived, the packet is valid only during the call
+    // false if the fragment is malformed or on_packet failed
+    auto feed(BufferPool& pool, std::span<const std::byte> fragment, const std::function<bool(std::span<const std::byte>)>& on_packet) -> bool;
+
+    ~Reassembler();
+};
+} // namespace p2p::proto
@@ -0,0 +1,164 @@
+#include "ice-agent-pool.hpp"
+#include "macros/unwrap.hpp"
+
+namespace p2p::ice {
+namespace {
+auto on_state_changed(juice_agent_t* const /*agent*/, const juice_state_t state, void* const user_ptr) -> void {
+    if(const auto session = std::bit_cast<PooledAgent*>(user_ptr)->session.load()) {
+        switch(state) {
+        case JUICE_STATE_COMPLETED:
+            session->on_p2p_connected_state(true);
+            break;
+        case JUICE_STATE_FAILED:
+            session->on_p2p_connected_state(false);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+auto on_candidate(juice_agent_t* const /*agent*/, const char* const sdp, void* const user_ptr) -> void {
+    // candidates gathered in the pool are part of the local description
+    if(const auto session = std::bit_cast<PooledAgent*>(user_ptr)->session.load()) {
+        session->on_p2p_new_candidate(std::string_view(sdp));
+    }
+}
+
+auto on_gathering_done(juice_agent_t* const /*agent*/, void* const user_ptr) -> void {
+    auto& pooled = *std::bit_cast<PooledAgent*>(user_ptr);
+    if(pooled.pool != nullptr) {
+        pooled.pool->on_agent_gathered(&pooled);
+    }
+}
+
+auto on_recv(juice_agent_t* const /*agent*/, const char* const data, const size_t size, void* const user_ptr) -> void {
+    if(const auto session = std::bit_cast<PooledAgent*>(user_ptr)->session.load()) {
+        session->on_p2p_datagram_received({(std::byte*)data, size});
+    }
+}
+} // namespace
+
+auto AgentPool::create_agent() -> std::unique_ptr<PooledAgent> {
+    auto pooled  = std::unique_ptr<PooledAgent>(new PooledAgent());
+    pooled->pool = this;
+
+    const auto& ice    = params.ice;
+    auto        config = juice_config_t{
+               .concurrency_mode       = ice.concurrency_mode,
+               .stun_server_host       = ice.stun_server.address.data(),
+               .stun_server_port       = ice.stun_server.port,
+               .bind_address           = params.bind_address,
+               .local_port_range_begin = ice.local_port_range_begin,
+               .local_port_range_end   = ice.local_port_range_end,
+               .cb_state_changed       = on_state_changed,
+               .cb_candidate           = on_candidate,
+               .cb_gathering_done      = on_gathering_done,
+               .cb_recv                = on_recv,
+               .user_ptr               = pooled.get(),
+    };
+    if(!ice.turn_servers.empty()) {
+        config.turn_servers       = (juice_turn_server_t*)ice.turn_servers.data();
+        config.turn_servers_count = ice.turn_servers.size();
+    }
+    pooled->agent.reset(juice_create(&config));
+    ensure(pooled->agent, "failed to create ice agent");
+    return pooled;
+}
+
+auto AgentPool::refill_main() -> void {
+    auto guard = std::unique_lock(lock);
+    while(!stopping) {
+        const auto now = std::chrono::steady_clock::now();
+        std::erase_if(ready, [this, now](const auto& pooled) { return now - pooled->gathered >= params.max_age; });
+        while(ready.size() + gathering.size() < params.size) {
+            // juice may block on dns resolution
+            guard.unlock();
+            auto pooled = create_agent();
+            guard.lock();
+            if(!pooled) {
+                line_warn("failed to create pooled agent");
+                break;
+            }
+            // listed before gathering so that on_gathering_done can find it
+            const auto agent = pooled->agent.get();
+            gathering.push_back(std::move(pooled));
+            guard.unlock();
+            // gathering before the remote description is set makes the agent controlling
+            const auto gathered = juice_gather_candidates(agent) == JUICE_ERR_SUCCESS;
+            guard.lock();
+            if(!gathered) {
+                line_warn("failed to start gathering of pooled agent");
+                std::erase_if(gathering, [agent](const auto& pooled) { return pooled->agent.get() == agent; });
+                break;
+            }
+        }
+        // wake up on take, on gathering done, or when the oldest agent gets stale
+        auto deadline = now + params.max_age;
+        for(const auto& pooled : ready) {
+            deadline = std::min(deadline, pooled->gathered + params.max_age);
+        }
+        condvar.wait_until(guard, deadline);
+    }
+}
+
+auto AgentPool::on_agent_gathered(PooledAgent* const agent) -> void {
+    auto guard = std::lock_guard(lock);
+    for(auto i = gathering.begin(); i != gathering.end(); i = std::next(i)) {
+        if(i->get() == agent) {
+            agent->gathered = std::chrono::steady_clock::now();
+            ready.push_back(std::move(*i));
+            gathering.erase(i);
+            break;
+        }
+    }
+    condvar.notify_all();
+}
+
+auto AgentPool::start(AgentPoolParams params) -> bool {
+    ensure(params.size > 0);
+    this->params = std::move(params);
+    refiller     = std::thread(&AgentPool::refill_main, this);
+    return true;
+}
+
+auto AgentPool::take(IceSession& session) -> std::unique_ptr<PooledAgent> {
+    auto       guard = std::lock_guard(lock);
+    const auto now   = std::chrono::steady_clock::now();
+    // newest first, it has the longest lifetime left
+    while(!ready.empty()) {
+        auto pooled = std::move(ready.back());
+        ready.pop_back();
+        if(now - pooled->gathered < params.max_age) {
+            pooled->pool = nullptr;
+            pooled->session.store(&session);
+            condvar.notify_all();
+            return pooled;
+        }
+    }
+    condvar.notify_all();
+    return nullptr;
+}
+
+AgentPool::~AgentPool() {
+    {
+        auto guard = std::lock_guard(lock);
+        stopping   = true;
+        condvar.notify_all();
+    }
+    if(refiller.joinable()) {
+        refiller.join();
+    }
+    // destroy agents without the lock, gathering callbacks may still be running and need it
+    auto agents = std::vector<std::unique_ptr<PooledAgent>>();
+    {
+        auto guard = std::lock_guard(lock);
+        agents     = std::move(gathering);
+        for(auto& pooled : ready) {
+            agents.push_back(std::move(pooled));
+        }
+        ready.clear();
+    }
+    agents.clear();
+}
+} // namespace p2p::ice
@@ -0,0 +1,56 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "ice-session.hpp"
+
+namespace p2p::ice {
+class AgentPool;
+
+struct AgentPoolParams {
+    IceSessionParams          ice;
+    const char*               bind_address = nullptr;
+    size_t                    size         = 4;
+    std::chrono::milliseconds max_age      = std::chrono::seconds(20); // nat mappings of older agents may be gone
+};
+
+// agent whose candidates were gathered before a session was assigned
+// callbacks are forwarded to the session once taken
+struct PooledAgent {
+    AutoJuiceAgent                        agent;
+    std::atomic<IceSession*>              session  = nullptr;
+    AgentPool*                            pool     = nullptr; // nullptr once taken
+    std::chrono::steady_clock::time_point gathered = {};
+};
+
+// keeps agents in controlling mode with gathered candidates ready to connect
+class AgentPool {
+  private:
+    AgentPoolParams                           params;
+    std::mutex                                lock;
+    std::condition_variable                   condvar;
+    std::vector<std::unique_ptr<PooledAgent>> ready;
+    std::vector<std::unique_ptr<PooledAgent>> gathering;
+    std::thread                               refiller;
+    bool                                      stopping = false;
+
+    auto create_agent() -> std::unique_ptr<PooledAgent>;
+    auto refill_main() -> void;
+
+  public:
+    // internal use
+    auto on_agent_gathered(PooledAgent* agent) -> void;
+
+    // api
+    auto start(AgentPoolParams params) -> bool;
+    // nullptr if no fresh agent is ready
+    auto take(IceSession& session) -> std::unique_ptr<PooledAgent>;
+
+    ~AgentPool();
+};
+} // namespace p2p::ice
@@ -7,6 +7,31 @@ struct Type {
         SetCandidates = ::p2p::plink::proto::Type::Limit,
         AddCandidates,
         GatheringDone,
+        Relay,        // not acked, datagrams when the p2p path failed
+        HostId,       // controlled -> controlling
+        SharedMemory, // controlling -> controlled, offered when host ids match
+        Features,     // both ways before SetCandidates, older peers answer with Error
+
+        Limit,
+    };
+};
+
+struct FeatureFlags {
+    enum : uint32_t {
+        BatchedCandidates = 1 << 0, // AddCandidates may carry several lines ending with end_of_candidates
+        DatagramKinds     = 1 << 1, // datagrams on the p2p path start with a DatagramKind
+    };
+};
+
+// first byte of every datagram on the p2p path, if both peers advertise FeatureFlags::DatagramKinds
+// otherwise datagrams are send_packet_p2p payloads as is
+struct DatagramKind {
+    enum : uint8_t {
+        Datagram, // send_packet_p2p
+        StreamData,
+        StreamAck,
+        Channel,
+        Coalesced, // several send_packet_p2p messages
 
         Limit,
     };
@@ -22,4 +47,20 @@ struct AddCandidates : ::p2p::proto::Packet {
 
 struct GatheringDone : ::p2p::proto::Packet {
 };
+
+struct Relay : ::p2p::proto::Packet {
+    // std::byte datagrams[]; DatagramKind::Coalesced followed by ([uint16 size][datagram])...
+};
+
+struct HostId : ::p2p::proto::Packet {
+    // char host_id[];
+};
+
+struct SharedMemory : ::p2p::proto::Packet {
+    // char name[]; posix shared memory object
+};
+
+struct Features : ::p2p::proto::Packet {
+    uint32_t flags; // FeatureFlags
+} __attribute__((packed));
 } // namespace p2p::ice::proto
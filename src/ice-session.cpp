@@ -1,4 +1,8 @@
+#include <cstring>
+#include <utility>
+
 #include "ice-session.hpp"
+#include "ice-agent-pool.hpp"
 #include "ice-session-protocol.hpp"
 #include "macros/unwrap.hpp"
 
@@ -30,10 +34,31 @@ auto on_gathering_done(juice_agent_t* const /*agent*/, void* const user_ptr) ->
 }
 
 auto on_recv(juice_agent_t* const /*agent*/, const char* const data, const size_t size, void* const user_ptr) -> void {
-    std::bit_cast<IceSession*>(user_ptr)->on_p2p_packet_received({(std::byte*)data, size});
+    std::bit_cast<IceSession*>(user_ptr)->on_p2p_datagram_received({(std::byte*)data, size});
 }
 } // namespace
 
+auto IceSession::get_agent() -> juice_agent_t* {
+    return pooled_agent ? pooled_agent->agent.get() : agent.get();
+}
+
+auto IceSession::is_framed() const -> bool {
+    return peer_features & proto::FeatureFlags::DatagramKinds;
+}
+
+auto IceSession::send_datagram(const std::span<const std::byte> datagram) -> bool {
+    if(const auto link = shm_active.load()) {
+        return link->send(datagram);
+    }
+    if(path_mode == PathMode::Relay) {
+        return udp_relay_active ? udp_relay->send(datagram) : relay.send(datagram);
+    }
+    // the restarter may replace the agent after a mode change we did not see
+    auto       guard = std::shared_lock(agent_lock);
+    const auto agent = get_agent();
+    return agent != nullptr && juice_send(agent, (const char*)datagram.data(), datagram.size()) == 0;
+}
+
 auto IceSession::on_packet_received(const std::span<const std::byte> payload) -> bool {
     unwrap(header, p2p::proto::extract_header(payload));
 
@@ -44,6 +69,7 @@ auto IceSession::on_packet_received(const std::span<const std::byte> payload) ->
             line_print("received remote candidates: ", sdp);
         }
         remote_sdp = sdp;
+        timeline.mark("remote sdp received");
         events.invoke(EventKind::SDPSet, no_id, no_value);
 
         send_result(::p2p::proto::Type::Success, header.id);
@@ -54,7 +80,22 @@ auto IceSession::on_packet_received(const std::span<const std::byte> payload) ->
         if(verbose) {
             line_print("received additional candidates: ", sdp);
         }
-        juice_add_remote_candidate(agent.get(), sdp.data());
+        // one candidate per line
+        auto guard = std::shared_lock(agent_lock);
+        auto line  = std::string();
+        for(auto rest = sdp; !rest.empty();) {
+            const auto lf = rest.find('\n');
+            line          = rest.substr(0, lf);
+            rest          = lf == rest.npos ? std::string_view() : rest.substr(lf + 1);
+            if(!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if(line == end_of_candidates) {
+                juice_set_remote_gathering_done(get_agent());
+            } else if(!line.empty()) {
+                juice_add_remote_candidate(get_agent(), line.data());
+            }
+        }
 
         send_result(::p2p::proto::Type::Success, header.id);
         return true;
@@ -63,12 +104,69 @@ auto IceSession::on_packet_received(const std::span<const std::byte> payload) ->
         if(verbose) {
             line_print("received gathering done");
         }
-        juice_set_remote_gathering_done(agent.get());
+        {
+            auto guard = std::shared_lock(agent_lock);
+            juice_set_remote_gathering_done(get_agent());
+        }
         // events.invoke(EventKind::RemoteGatheringDone, no_id, no_value);
 
         send_result(::p2p::proto::Type::Success, header.id);
         return true;
     }
+    case proto::Type::HostId: {
+        const auto host_id = p2p::proto::extract_last_string<proto::HostId>(payload);
+        if(verbose) {
+            line_print("received peer host id: ", host_id);
+        }
+        if(!offer_shared_memory(host_id)) {
+            line_warn("failed to offer shared memory");
+        }
+        send_result(::p2p::proto::Type::Success, header.id);
+        return true;
+    }
+    case proto::Type::SharedMemory: {
+        const auto name = p2p::proto::extract_last_string<proto::SharedMemory>(payload);
+        ensure(accept_shared_memory(name));
+        send_result(::p2p::proto::Type::Success, header.id);
+        return true;
+    }
+    case proto::Type::Features: {
+        unwrap(packet, p2p::proto::extract_payload<proto::Features>(payload));
+        if(verbose) {
+            line_print("received peer features: ", packet.flags);
+        }
+        peer_features = packet.flags;
+        send_result(::p2p::proto::Type::Success, header.id);
+        return true;
+    }
+    case plink::proto::Type::UdpRelayAllocated: {
+        unwrap(packet, p2p::proto::extract_payload<plink::proto::UdpRelayAllocated>(payload));
+        // both peers receive it, and again when the peer asked too
+        if(udp_relay) {
+            return true;
+        }
+        auto link = std::unique_ptr<UdpRelayLink>(new UdpRelayLink());
+        if(!link->start(peer_linker_address, packet.port, packet.token, packet.key, [this](const std::span<const std::byte> datagram) { on_p2p_datagram_received(datagram); })) {
+            line_warn("failed to open udp relay, keep relaying through the peer-linker");
+            return true;
+        }
+        udp_relay        = std::move(link);
+        udp_relay_active = true;
+        line_print("relaying over udp port ", packet.port);
+        timeline.mark("udp relay");
+        return true;
+    }
+    case proto::Type::Relay: {
+        // not acked, a lost peer-linker connection ends the session anyway
+        const auto datagrams = payload.subspan(sizeof(proto::Relay));
+        const auto ok        = !datagrams.empty() && Coalescer::split(datagrams, [this](const std::span<const std::byte> datagram) {
+            on_p2p_datagram_received(datagram);
+        });
+        if(!ok && verbose) {
+            line_print("malformed relay packet");
+        }
+        return true;
+    }
     default:
         return plink::PeerLinkerSession::on_packet_received(payload);
     }
@@ -76,9 +174,33 @@ auto IceSession::on_packet_received(const std::span<const std::byte> payload) ->
 
 auto IceSession::on_p2p_connected_state(const bool flag) -> void {
     if(flag) {
-        events.invoke(EventKind::Connected, no_id, no_value);
-    } else {
+        if(path_mode.exchange(PathMode::Direct) == PathMode::Relay) {
+            line_print("ice restarted, leaving relay mode");
+            timeline.mark("ice restarted");
+        } else {
+            timeline.mark("ice connected");
+        }
+        events.invoke(EventKind::Connected, no_id, 1);
+        return;
+    }
+    if(!ice_params.relay_fallback) {
         stop();
+        return;
+    }
+    if(path_mode.exchange(PathMode::Relay) == PathMode::Direct) {
+        line_warn("ice failed, relaying through the peer-linker");
+        timeline.mark("relay fallback");
+        if(ice_params.udp_relay && !controlled && !udp_relay) {
+            send_packet_detached(plink::proto::Type::AllocateUdpRelay, [](const uint32_t result) {
+                ensure_v(result, "udp relay allocation failed");
+            });
+        }
+    }
+    if(connecting) {
+        events.invoke(EventKind::Connected, no_id, 0);
+    } else {
+        // connection lost after it was established
+        start_restarter();
     }
 }
 
@@ -86,74 +208,411 @@ auto IceSession::on_p2p_new_candidate(const std::string_view sdp) -> void {
     if(verbose) {
         line_print("new candidate: ", sdp);
     }
-    send_packet_detached(
-        proto::Type::AddCandidates, [](uint32_t result) { ensure_v(result, "failed to send new candidate"); }, sdp);
+    candidate_batcher.add(sdp);
 }
 
 auto IceSession::on_p2p_gathering_done() -> void {
     if(verbose) {
         line_print("gathering done");
     }
-    send_packet_detached(
-        proto::Type::GatheringDone, [](uint32_t result) { ensure_v(result, "failed to send gathering done signal"); });
+    timeline.mark("gathering done");
+    // sent with the last batch
+    candidate_batcher.finish();
+}
+
+auto IceSession::on_p2p_datagram_received(const std::span<const std::byte> datagram) -> void {
+    auto guard = std::lock_guard(receive_lock);
+    if(!is_framed()) {
+        on_p2p_packet_received(datagram);
+        return;
+    }
+    if(datagram.empty()) {
+        return;
+    }
+    switch(uint8_t(datagram[0])) {
+    case proto::DatagramKind::Datagram:
+        on_p2p_packet_received(datagram.subspan(1));
+        break;
+    case proto::DatagramKind::StreamData:
+    case proto::DatagramKind::StreamAck:
+        if(stream) {
+            stream->on_datagram(datagram);
+        }
+        break;
+    case proto::DatagramKind::Channel:
+        channels.on_datagram(datagram);
+        break;
+    case proto::DatagramKind::Coalesced:
+        if(!Coalescer::split(datagram, [this](const std::span<const std::byte> payload) { on_p2p_packet_received(payload); }) && verbose) {
+            line_print("malformed coalesced datagram");
+        }
+        break;
+    default:
+        if(verbose) {
+            line_print("unknown datagram kind ", int(datagram[0]));
+        }
+        break;
+    }
 }
 
 auto IceSession::on_p2p_packet_received(const std::span<const std::byte> payload) -> void {
     line_print("p2p data received: ", payload.size(), " bytes");
 }
 
+auto IceSession::on_p2p_stream_received(const std::span<const std::byte> payload) -> void {
+    line_print("p2p stream received: ", payload.size(), " bytes");
+}
+
 auto IceSession::start(const IceSessionParams& params, const plink::PeerLinkerSessionParams& plink_params) -> bool {
     ensure(plink::PeerLinkerSession::start(plink_params));
     ensure(start_ice(params, plink_params));
     return true;
 }
 
-auto IceSession::start_ice(const IceSessionParams& params, const plink::PeerLinkerSessionParams& plink_params) -> bool {
-    const auto controlled = plink_params.target_pad_name.empty();
-
+auto IceSession::create_agent() -> bool {
     auto config = juice_config_t{
-        .stun_server_host  = params.stun_server.address.data(),
-        .stun_server_port  = params.stun_server.port,
-        .bind_address      = plink_params.bind_address,
+        .concurrency_mode  = ice_params.concurrency_mode,
+        .stun_server_host  = ice_params.stun_server.address.data(),
+        .stun_server_port  = ice_params.stun_server.port,
+        .bind_address      = bind_address,
         .cb_state_changed  = on_state_changed,
         .cb_candidate      = on_candidate,
         .cb_gathering_done = on_gathering_done,
         .cb_recv           = on_recv,
         .user_ptr          = this,
     };
-    if(!params.turn_servers.empty()) {
-        config.turn_servers       = (juice_turn_server_t*)params.turn_servers.data();
-        config.turn_servers_count = params.turn_servers.size();
+    if(!ice_params.turn_servers.empty()) {
+        config.turn_servers       = (juice_turn_server_t*)ice_params.turn_servers.data();
+        config.turn_servers_count = ice_params.turn_servers.size();
     }
-    if(controlled) {
+    if(ice_params.local_port_range_begin != 0) {
+        config.local_port_range_begin = ice_params.local_port_range_begin;
+        config.local_port_range_end   = ice_params.local_port_range_end;
+    } else if(controlled) {
         config.local_port_range_begin = 60000;
         config.local_port_range_end   = 61000;
     }
-    agent.reset(juice_create(&config));
+    auto created = AutoJuiceAgent(juice_create(&config));
+    ensure(created, "failed to create ice agent");
+
+    auto retired        = AutoJuiceAgent();
+    auto retired_pooled = std::unique_ptr<PooledAgent>();
+    {
+        auto guard     = std::unique_lock(agent_lock);
+        retired_pooled = std::move(pooled_agent);
+        retired        = std::exchange(agent, std::move(created));
+    }
+    // destroyed outside of the lock, it joins the agent thread which may be waiting in send_datagram
+    // no sender can hold the old agent once the swap is done
+    return true;
+}
+
+auto IceSession::connect_agent() -> std::optional<bool> {
+    connecting = true;
     if(controlled) {
         ensure(wait_for_event(EventKind::SDPSet));
-        juice_set_remote_description(agent.get(), remote_sdp.data());
+        juice_set_remote_description(get_agent(), remote_sdp.data());
+        // the controlling peer is in start_ice by now
+        if(ice_params.shared_memory && !shm) {
+            if(const auto host_id = read_host_id()) {
+                send_packet_detached(proto::Type::HostId, [](uint32_t) {}, std::string_view(*host_id));
+            }
+        }
     }
 
     auto sdp = std::array<char, JUICE_MAX_SDP_STRING_LEN>();
-    ensure(juice_get_local_description(agent.get(), sdp.data(), sdp.size()) == JUICE_ERR_SUCCESS);
+    ensure(juice_get_local_description(get_agent(), sdp.data(), sdp.size()) == JUICE_ERR_SUCCESS);
     if(verbose) {
-        line_print(plink_params.pad_name, "local sdp: ", sdp.data());
+        line_print("local sdp: ", sdp.data());
     }
     ensure(send_packet(proto::Type::SetCandidates, std::string_view(sdp.data())));
+    timeline.mark("local sdp sent");
     if(!controlled) {
         ensure(wait_for_event(EventKind::SDPSet));
-        juice_set_remote_description(agent.get(), remote_sdp.data());
+        juice_set_remote_description(get_agent(), remote_sdp.data());
     }
 
-    juice_gather_candidates(agent.get());
+    juice_gather_candidates(get_agent());
+    timeline.mark("gathering started");
     // seems not mandatory
     // ensure(wait_for_event(EventKind::RemoteGatheringDone));
-    ensure(wait_for_event(EventKind::Connected));
+    unwrap(connected, wait_for_event(EventKind::Connected));
+    connecting = false;
+    return connected != 0;
+}
+
+auto IceSession::start_restarter() -> void {
+    auto guard = std::lock_guard(restart_lock);
+    if(restarting || restart_stopping) {
+        return;
+    }
+    // finished after a previous restart succeeded
+    if(restarter.joinable()) {
+        restarter.join();
+    }
+    restarting = true;
+    restarter  = std::thread(&IceSession::restart_main, this);
+}
+
+auto IceSession::restart_main() -> void {
+    while(true) {
+        {
+            auto guard = std::unique_lock(restart_lock);
+            // the controlled peer restarts when the controlling one sends a new description
+            if(!controlled) {
+                restart_condvar.wait_for(guard, ice_params.ice_restart_interval, [this] { return restart_stopping; });
+            }
+            if(restart_stopping) {
+                break;
+            }
+        }
+        timeline.mark("ice restart");
+        candidate_batcher.start(ice_params.candidate_batch_window, ice_params.candidate_batch_size,
+                                [this](std::string lines) { send_candidates(std::move(lines)); });
+        if(!create_agent()) {
+            break;
+        }
+        const auto connected = connect_agent();
+        if(!connected || *connected) {
+            // stopped or back to direct
+            break;
+        }
+    }
+    auto guard = std::lock_guard(restart_lock);
+    restarting = false;
+}
+
+auto IceSession::send_candidates(const std::string lines) -> void {
+    const auto on_result = [](uint32_t result) { ensure_v(result, "failed to send new candidates"); };
+    if(peer_features & proto::FeatureFlags::BatchedCandidates) {
+        send_packet_detached(proto::Type::AddCandidates, on_result, std::string_view(lines));
+        return;
+    }
+    // older peers take one candidate per packet and a separate GatheringDone
+    for(auto rest = std::string_view(lines); !rest.empty();) {
+        const auto lf   = rest.find('\n');
+        const auto line = rest.substr(0, lf);
+        rest            = lf == rest.npos ? std::string_view() : rest.substr(lf + 1);
+        if(line == end_of_candidates) {
+            send_packet_detached(
+                proto::Type::GatheringDone, [](uint32_t result) { ensure_v(result, "failed to send gathering done signal"); });
+        } else if(!line.empty()) {
+            send_packet_detached(proto::Type::AddCandidates, on_result, line);
+        }
+    }
+}
+
+auto IceSession::offer_shared_memory(const std::string_view peer_host_id) -> bool {
+    if(controlled || !ice_params.shared_memory || shm) {
+        return true;
+    }
+    unwrap(host_id, read_host_id());
+    if(host_id != peer_host_id) {
+        return true;
+    }
+    shm.reset(new ShmLink());
+    ensure(shm->create(ice_params.shared_memory_size));
+    shm->start([this](const std::span<const std::byte> datagram) { on_p2p_datagram_received(datagram); },
+               [this] { on_shm_broken(); });
+    send_packet_detached(
+        proto::Type::SharedMemory, [this](const uint32_t result) {
+            // the name is not needed once mapped by the peer
+            shm->unlink();
+            ensure_v(result, "peer failed to map shared memory");
+            ensure_v(!shm->is_broken(), "shared memory link broken before use");
+            shm_active = shm.get();
+            line_print("peer is on the same host, using shared memory");
+            timeline.mark("shared memory");
+        },
+        std::string_view(shm->get_name()));
+    return true;
+}
+
+auto IceSession::accept_shared_memory(const std::string_view name) -> bool {
+    ensure(controlled && ice_params.shared_memory && !shm, "unexpected shared memory offer");
+    auto link = std::unique_ptr<ShmLink>(new ShmLink());
+    ensure(link->open(name));
+    link->start([this](const std::span<const std::byte> datagram) { on_p2p_datagram_received(datagram); },
+                [this] { on_shm_broken(); });
+    shm        = std::move(link);
+    shm_active = shm.get();
+    line_print("peer is on the same host, using shared memory");
+    timeline.mark("shared memory");
+    return true;
+}
+
+auto IceSession::on_shm_broken() -> void {
+    // the link object stays alive until the session ends, senders holding it see it broken
+    if(shm_active.exchange(nullptr) != nullptr) {
+        line_warn("shared memory link broken, leaving shared memory mode");
+        timeline.mark("shared memory broken");
+    }
+}
+
+auto IceSession::start_ice(const IceSessionParams& params, const plink::PeerLinkerSessionParams& plink_params) -> bool {
+    controlled          = plink_params.target_pad_name.empty();
+    ice_params          = params;
+    bind_address        = plink_params.bind_address;
+    peer_linker_address = plink_params.peer_linker.address;
+    if(params.concurrency_mode == JUICE_CONCURRENCY_MODE_MUX) {
+        ensure(params.local_port_range_begin != 0 && params.local_port_range_begin == params.local_port_range_end,
+               "mux mode requires a single local port");
+    }
+    if(params.stream) {
+        stream.reset(new ReliableStream());
+        stream->start(
+            *params.stream, proto::DatagramKind::StreamData, proto::DatagramKind::StreamAck,
+            [this](const std::span<const std::byte> datagram) { return send_datagram(datagram); },
+            [this](const std::span<const std::byte> payload) { on_p2p_stream_received(payload); });
+    }
+    channels.start(params.channel_rate, proto::DatagramKind::Channel,
+                   [this](const std::span<const std::byte> datagram) { return send_datagram(datagram); });
+    coalesce = params.coalesce_budget.count() > 0;
+    if(coalesce) {
+        coalescer.start(params.coalesce_budget, params.coalesce_size, proto::DatagramKind::Coalesced,
+                        [this](const std::span<const std::byte> datagram) { return send_datagram(datagram); });
+    }
+    if(params.relay_fallback) {
+        relay.start(params.relay_batch_window, params.relay_batch_size, proto::DatagramKind::Coalesced,
+                    [this](const std::span<const std::byte> datagrams) {
+                        send_generic_packet(proto::Type::Relay, 0, datagrams);
+                        return true;
+                    });
+    }
+    candidate_batcher.start(params.candidate_batch_window, params.candidate_batch_size,
+                            [this](std::string lines) { send_candidates(std::move(lines)); });
+    // arrives before our SetCandidates, so the peer knows our features before it gathers
+    // an older peer answers with Error and keeps peer_features at none on our side
+    send_packet_detached(proto::Type::Features, [](uint32_t) {}, uint32_t(proto::FeatureFlags::BatchedCandidates | proto::FeatureFlags::DatagramKinds));
+
+    if(!controlled && params.agent_pool != nullptr) {
+        pooled_agent = params.agent_pool->take(*this);
+        if(pooled_agent) {
+            timeline.mark("pooled agent taken");
+            return start_pooled_ice(plink_params);
+        }
+    }
+
+    ensure(create_agent());
+    unwrap(connected, connect_agent());
+    if(!connected) {
+        start_restarter();
+    }
+    return true;
+}
+
+auto IceSession::start_pooled_ice(const plink::PeerLinkerSessionParams& plink_params) -> bool {
+    // candidates are already gathered, send them all at once
+    connecting = true;
+    auto sdp   = std::array<char, JUICE_MAX_SDP_STRING_LEN>();
+    ensure(juice_get_local_description(get_agent(), sdp.data(), sdp.size()) == JUICE_ERR_SUCCESS);
+    if(verbose) {
+        line_print(plink_params.pad_name, "local sdp: ", sdp.data());
+    }
+    ensure(send_packet(proto::Type::SetCandidates, std::string_view(sdp.data())));
+    timeline.mark("local sdp sent");
+    ensure(wait_for_event(EventKind::SDPSet));
+    // after the peer's Features, which precede its description, to pick how to signal it
+    on_p2p_gathering_done();
+    juice_set_remote_description(get_agent(), remote_sdp.data());
+    unwrap(connected, wait_for_event(EventKind::Connected));
+    connecting = false;
+    if(!connected) {
+        start_restarter();
+    }
     return true;
 }
 
 auto IceSession::send_packet_p2p(const std::span<const std::byte> payload) -> bool {
-    return juice_send(agent.get(), (const char*)payload.data(), payload.size()) == 0;
+    if(!is_framed()) {
+        return send_datagram(payload);
+    }
+    if(coalesce) {
+        return coalescer.send(payload);
+    }
+    // reused to avoid an allocation per packet
+    thread_local auto datagram = std::vector<std::byte>();
+    datagram.resize(1 + payload.size());
+    datagram[0] = std::byte(proto::DatagramKind::Datagram);
+    std::memcpy(datagram.data() + 1, payload.data(), payload.size());
+    return send_datagram(datagram);
+}
+
+auto IceSession::write_stream(const std::span<const std::byte> data) -> bool {
+    ensure(stream, "stream not enabled");
+    ensure(is_framed(), "peer does not support streams");
+    return stream->write(data);
+}
+
+auto IceSession::flush_stream() -> bool {
+    ensure(stream, "stream not enabled");
+    return stream->flush();
+}
+
+auto IceSession::get_stream_stats() -> std::optional<StreamStats> {
+    if(!stream) {
+        return std::nullopt;
+    }
+    return stream->get_stats();
+}
+
+auto IceSession::get_coalesce_stats() -> std::optional<CoalesceStats> {
+    if(!coalesce) {
+        return std::nullopt;
+    }
+    return coalescer.get_stats();
+}
+
+auto IceSession::get_path_mode() const -> uint8_t {
+    return shm_active ? uint8_t(PathMode::SharedMemory) : path_mode.load();
+}
+
+auto IceSession::open_channel(const uint8_t id, ChannelParams params) -> bool {
+    return channels.open(id, std::move(params));
+}
+
+auto IceSession::close_channel(const uint8_t id) -> void {
+    channels.close(id);
+}
+
+auto IceSession::send_channel(const uint8_t id, const std::span<const std::byte> payload) -> bool {
+    ensure(is_framed(), "peer does not support channels");
+    return channels.send(id, payload);
+}
+
+auto IceSession::get_channel_stats(const uint8_t id) -> std::optional<ChannelStats> {
+    return channels.get_stats(id);
+}
+
+IceSession::IceSession() {}
+
+IceSession::~IceSession() {
+    {
+        auto guard       = std::lock_guard(restart_lock);
+        restart_stopping = true;
+        restart_condvar.notify_one();
+    }
+    if(restarter.joinable()) {
+        // unblocks a restart waiting for the peer
+        stop();
+        restarter.join();
+    }
+    // the stream sends through the agent and the agent feeds the stream
+    if(stream) {
+        stream->stop();
+    }
+    channels.stop();
+    coalescer.stop();
+    relay.stop();
+    shm_active = nullptr;
+    if(shm) {
+        shm->stop();
+    }
+    udp_relay_active = false;
+    if(udp_relay) {
+        udp_relay->stop();
+    }
+    agent.reset();
+    pooled_agent.reset();
 }
 } // namespace p2p::ice
@@ -1,7 +1,19 @@
 #pragma once
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+
 #include <juice/juice.h>
 
+#include "candidate-batcher.hpp"
+#include "channel-mux.hpp"
+#include "coalescer.hpp"
 #include "peer-linker-session.hpp"
+#include "reliable-stream.hpp"
+#include "shm-link.hpp"
+#include "udp-relay-link.hpp"
 
 namespace p2p::ice {
 declare_autoptr(JuiceAgent, juice_agent_t, juice_destroy);
@@ -16,15 +28,105 @@ struct EventKind {
     };
 };
 
+struct PathMode {
+    enum : uint8_t {
+        Direct,       // ice
+        Relay,        // through the peer-linker
+        SharedMemory, // peer on the same host
+    };
+};
+
+class AgentPool;
+struct PooledAgent;
+
 struct IceSessionParams {
     wss::ServerLocation              stun_server;
     std::vector<juice_turn_server_t> turn_servers;
+    // JUICE_CONCURRENCY_MODE_MUX shares one socket and one thread among agents bound to the same port
+    // and requires local_port_range_begin == local_port_range_end
+    juice_concurrency_mode_t concurrency_mode = JUICE_CONCURRENCY_MODE_POLL;
+    // 0 for the default, 60000-61000 for controlled agents and any port for controlling ones
+    uint16_t local_port_range_begin = 0;
+    uint16_t local_port_range_end   = 0;
+    // controlling sessions take a pre-gathered agent from the pool if one is ready
+    AgentPool* agent_pool = nullptr;
+    // trickled candidates are sent in AddCandidates batches of up to this many candidates or this long
+    // one by one to peers that do not advertise FeatureFlags::BatchedCandidates
+    std::chrono::milliseconds candidate_batch_window = std::chrono::milliseconds(10);
+    size_t                    candidate_batch_size   = 8;
+    // reliable stream sharing the p2p path, both peers must enable it
+    std::optional<StreamParams> stream;
+    // bytes per second shared by logical channels, sent in priority order
+    // 0 sends channel messages immediately without scheduling
+    uint64_t channel_rate = 0;
+    // send_packet_p2p messages are held up to this long to be packed with others, 0 to send each immediately
+    // sent as is to peers that do not advertise FeatureFlags::DatagramKinds
+    std::chrono::microseconds coalesce_budget = {};
+    size_t                    coalesce_size   = 1200; // bytes, must fit the path mtu
+    // when ice fails, datagrams are relayed by the peer-linker until an ice restart succeeds
+    // both peers must enable it
+    bool                      relay_fallback       = false;
+    std::chrono::microseconds relay_batch_window   = std::chrono::milliseconds(1);
+    size_t                    relay_batch_size     = 16 * 1024; // bytes, packet size is 16 bits
+    std::chrono::milliseconds ice_restart_interval = std::chrono::seconds(10); // between restarts by the controlling peer
+    // in relay mode, ask the peer-linker for a udp relay instead of tunnelling through the websocket
+    bool udp_relay = false;
+    // peers on the same host exchange datagrams through shared memory rings instead, both peers must enable it
+    bool   shared_memory      = false;
+    size_t shared_memory_size = 4 * 1024 * 1024; // bytes per direction
 };
 
 class IceSession : public plink::PeerLinkerSession {
   private:
-    AutoJuiceAgent agent;
-    std::string    remote_sdp;
+    CandidateBatcher                candidate_batcher; // fed by the agent, must outlive it
+    AutoJuiceAgent                  agent;
+    std::unique_ptr<PooledAgent>    pooled_agent; // owns the agent instead if taken from a pool
+    std::string                     remote_sdp;
+    std::unique_ptr<ReliableStream> stream;
+    ChannelMux                      channels;
+    Coalescer                       coalescer;
+    bool                            coalesce = false;
+    std::atomic<uint32_t>           peer_features = 0; // proto::FeatureFlags, none until the peer sends Features
+
+    // for ice restarts
+    IceSessionParams        ice_params;
+    const char*             bind_address = nullptr;
+    bool                    controlled   = false;
+    std::shared_mutex       agent_lock; // exclusive to swap the agent, shared to use it from other threads
+    std::atomic<uint8_t>    path_mode  = PathMode::Direct;
+    std::atomic<bool>       connecting = false; // someone waits for EventKind::Connected
+    Coalescer               relay;
+    std::mutex              restart_lock;
+    std::condition_variable restart_condvar;
+    std::thread             restarter;
+    bool                    restarting       = false;
+    bool                    restart_stopping = false;
+
+    // datagrams arrive on the agent, shared memory, udp relay and signaling threads
+    // handled one at a time so stream data and packets are delivered in the order they are handled
+    std::mutex receive_lock;
+
+    std::unique_ptr<ShmLink> shm;
+    std::atomic<ShmLink*>    shm_active = nullptr; // set once both peers mapped the segment
+
+    std::string                   peer_linker_address;
+    std::unique_ptr<UdpRelayLink> udp_relay;
+    std::atomic<bool>             udp_relay_active = false;
+
+    auto get_agent() -> juice_agent_t*;
+    auto create_agent() -> bool;
+    // exchanges descriptions and waits for the result, false if ice failed
+    auto connect_agent() -> std::optional<bool>;
+    auto start_restarter() -> void;
+    auto restart_main() -> void;
+    auto send_candidates(std::string lines) -> void;
+    auto offer_shared_memory(std::string_view peer_host_id) -> bool;
+    auto accept_shared_memory(std::string_view name) -> bool;
+    auto on_shm_broken() -> void;
+    // datagram already prefixed with its kind
+    auto send_datagram(std::span<const std::byte> datagram) -> bool;
+    // whether datagrams carry a DatagramKind, which streams, channels and coalescing need
+    auto is_framed() const -> bool;
 
   protected:
     virtual auto on_packet_received(std::span<const std::byte> payload) -> bool override;
@@ -34,14 +136,33 @@ class IceSession : public plink::PeerLinkerSession {
     auto on_p2p_connected_state(bool flag) -> void;
     auto on_p2p_new_candidate(std::string_view sdp) -> void;
     auto on_p2p_gathering_done() -> void;
+    auto on_p2p_datagram_received(std::span<const std::byte> datagram) -> void;
 
     // api
     virtual auto on_p2p_packet_received(std::span<const std::byte> payload) -> void;
+    // in order stream data, payload is only valid during the call
+    // receive callbacks are serialized across paths and must not wait for the peer, e.g. in flush_stream
+    virtual auto on_p2p_stream_received(std::span<const std::byte> payload) -> void;
 
     auto start(const IceSessionParams& params, const plink::PeerLinkerSessionParams& plink_params) -> bool;
     auto start_ice(const IceSessionParams& params, const plink::PeerLinkerSessionParams& plink_params) -> bool;
+    auto start_pooled_ice(const plink::PeerLinkerSessionParams& plink_params) -> bool;
     auto send_packet_p2p(const std::span<const std::byte> payload) -> bool;
+    // blocks while the send buffer is full
+    auto write_stream(std::span<const std::byte> data) -> bool;
+    // blocks until the peer received everything written
+    auto flush_stream() -> bool;
+    auto get_stream_stats() -> std::optional<StreamStats>;
+    auto get_coalesce_stats() -> std::optional<CoalesceStats>;
+    // PathMode
+    auto get_path_mode() const -> uint8_t;
+    // params.on_received is called from a receiving thread, see on_p2p_stream_received
+    auto open_channel(uint8_t id, ChannelParams params) -> bool;
+    auto close_channel(uint8_t id) -> void;
+    auto send_channel(uint8_t id, std::span<const std::byte> payload) -> bool;
+    auto get_channel_stats(uint8_t id) -> std::optional<ChannelStats>;
 
-    virtual ~IceSession() {}
+    IceSession();
+    virtual ~IceSession();
 };
 } // namespace p2p::ice
@@ -0,0 +1,141 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include "logger.hpp"
+
+namespace logger {
+auto RecordWriter::append(const std::string_view str) -> void {
+    const auto len = std::min(str.size(), record.text.size() - record.size);
+    std::memcpy(record.text.data() + record.size, str.data(), len);
+    record.size += len;
+}
+
+auto RecordWriter::append(const void* const ptr) -> void {
+    auto& text = record.text;
+    append(std::string_view("0x"));
+    const auto [end, ec] = std::to_chars(text.data() + record.size, text.data() + text.size(), std::bit_cast<uintptr_t>(ptr), 16);
+    if(ec == std::errc()) {
+        record.size = end - text.data();
+    }
+}
+
+auto Logger::acquire_slot() -> Slot* {
+    auto pos = enqueue_pos.load(std::memory_order_relaxed);
+loop:
+    auto&      slot = ring[pos % ring_size];
+    const auto seq  = slot.sequence.load(std::memory_order_acquire);
+    const auto diff = intptr_t(seq) - intptr_t(pos);
+    if(diff == 0) {
+        if(!enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+            goto loop;
+        }
+        slot.record.timestamp = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        return &slot;
+    } else if(diff < 0) {
+        // ring is full, never block the producer
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    } else {
+        pos = enqueue_pos.load(std::memory_order_relaxed);
+        goto loop;
+    }
+}
+
+auto Logger::commit_slot(Slot& slot) -> void {
+    // sequence was equal to the enqueue position when acquired
+    slot.sequence.store(slot.sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    published.fetch_add(1);
+    if(sleeping.load()) {
+        published.notify_one();
+    }
+}
+
+auto Logger::drain() -> bool {
+    constexpr std::string_view level_str[] = {"DEBUG", "INFO ", "WARN ", "ERROR"};
+
+    auto written = false;
+    while(true) {
+        auto&      slot = ring[dequeue_pos % ring_size];
+        const auto seq  = slot.sequence.load(std::memory_order_acquire);
+        if(seq != dequeue_pos + 1) {
+            break;
+        }
+        const auto& record  = slot.record;
+        const auto  seconds = std::time_t(record.timestamp / 1000000);
+        auto        tm      = std::tm();
+        localtime_r(&seconds, &tm);
+        std::printf("%02d:%02d:%02d.%06d %.*s %.*s\n",
+                    tm.tm_hour, tm.tm_min, tm.tm_sec, int(record.timestamp % 1000000),
+                    int(level_str[int(record.level)].size()), level_str[int(record.level)].data(),
+                    int(record.size), record.text.data());
+        slot.sequence.store(dequeue_pos + ring_size, std::memory_order_release);
+        dequeue_pos += 1;
+        written = true;
+    }
+    if(written) {
+        std::fflush(stdout);
+    }
+    return written;
+}
+
+auto Logger::get_dropped() const -> uint64_t {
+    return dropped.load(std::memory_order_relaxed);
+}
+
+Logger::Logger() {
+    for(auto i = size_t(0); i < ring_size; i += 1) {
+        ring[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    worker = std::thread([this]() {
+        auto reported = uint64_t(0);
+        while(true) {
+            const auto seen = published.load(std::memory_order_acquire);
+            drain();
+            if(const auto count = get_dropped(); count != reported) {
+                std::printf("logger: %llu records dropped\n", (unsigned long long)(count - reported));
+                std::fflush(stdout);
+                reported = count;
+            }
+            if(!running.load()) {
+                break;
+            }
+            // a producer either sees sleeping or its increment is seen by wait
+            sleeping.store(true);
+            published.wait(seen);
+            sleeping.store(false);
+        }
+    });
+}
+
+Logger::~Logger() {
+    running.store(false);
+    published.fetch_add(1);
+    published.notify_one();
+    worker.join();
+    drain();
+}
+
+auto get() -> Logger& {
+    static auto instance = Logger();
+    return instance;
+}
+
+auto set_level(const Level level) -> void {
+    current_level.store(level, std::memory_order_relaxed);
+}
+
+auto parse_level(const std::string_view str) -> std::optional<Level> {
+    if(str == "debug") {
+        return Level::Debug;
+    } else if(str == "info") {
+        return Level::Info;
+    } else if(str == "warn") {
+        return Level::Warn;
+    } else if(str == "error") {
+        return Level::Error;
+    } else {
+        return std::nullopt;
+    }
+}
+} // namespace logger
@@ -0,0 +1,163 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <concepts>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <thread>
+
+namespace logger {
+enum class Level : uint8_t {
+    Debug,
+    Info,
+    Warn,
+    Error,
+};
+
+struct Record {
+    static constexpr auto text_capacity = 240;
+
+    int64_t                         timestamp; // unix time in microseconds
+    uint16_t                        size;
+    Level                           level;
+    std::array<char, text_capacity> text;
+};
+
+// fixed size formatter writing into a record, truncates on overflow
+struct RecordWriter {
+    Record& record;
+
+    auto append(std::string_view str) -> void;
+
+    template <std::integral T>
+    auto append(const T num) -> void {
+        if constexpr(std::same_as<T, bool>) {
+            append(num ? std::string_view("true") : std::string_view("false"));
+        } else if constexpr(std::same_as<T, char>) {
+            append(std::string_view(&num, 1));
+        } else {
+            auto& text           = record.text;
+            const auto [ptr, ec] = std::to_chars(text.data() + record.size, text.data() + text.size(), num);
+            if(ec == std::errc()) {
+                record.size = ptr - text.data();
+            }
+        }
+    }
+
+    template <std::floating_point T>
+    auto append(const T num) -> void {
+        auto& text           = record.text;
+        const auto [ptr, ec] = std::to_chars(text.data() + record.size, text.data() + text.size(), num);
+        if(ec == std::errc()) {
+            record.size = ptr - text.data();
+        }
+    }
+
+    auto append(const void* ptr) -> void;
+
+    auto append(const char* str) -> void {
+        append(std::string_view(str));
+    }
+
+    template <class T>
+        requires std::convertible_to<const T&, std::string_view>
+    auto append(const T& str) -> void {
+        append(std::string_view(str));
+    }
+};
+
+// bounded lock-free multi producer ring drained by a background thread
+class Logger {
+  private:
+    static constexpr auto ring_size = size_t(4096);
+
+    struct Slot {
+        std::atomic<size_t> sequence;
+        Record              record;
+    };
+
+    std::array<Slot, ring_size> ring;
+    std::atomic<size_t>         enqueue_pos = 0;
+    size_t                      dequeue_pos = 0;
+    std::atomic<uint32_t>       published   = 0;
+    std::atomic_bool            sleeping    = false; // producers notify only while the worker waits
+    std::atomic<uint64_t>       dropped     = 0;
+    std::atomic_bool            running     = true;
+    std::thread                 worker;
+
+    auto acquire_slot() -> Slot*;
+    auto commit_slot(Slot& slot) -> void;
+    auto drain() -> bool;
+
+  public:
+    template <class... Args>
+    auto write(const Level level, const Args&... args) -> void {
+        const auto slot = acquire_slot();
+        if(slot == nullptr) {
+            return;
+        }
+        auto& record = slot->record;
+        record.level = level;
+        record.size  = 0;
+        auto writer  = RecordWriter{record};
+        (writer.append(args), ...);
+        commit_slot(*slot);
+    }
+
+    auto get_dropped() const -> uint64_t;
+
+    Logger();
+    ~Logger();
+};
+
+inline auto current_level = std::atomic<Level>(Level::Info);
+
+auto get() -> Logger&;
+
+inline auto is_enabled(const Level level) -> bool {
+    return level >= current_level.load(std::memory_order_relaxed);
+}
+
+auto set_level(Level level) -> void;
+auto parse_level(std::string_view str) -> std::optional<Level>;
+} // namespace logger
+
+// arguments are not evaluated when the level is disabled
+#define log_at(level, ...)             \
+    if(!::logger::is_enabled(level)) { \
+    } else                             \
+        ::logger::get().write(level __VA_OPT__(, ) __VA_ARGS__)
+
+#define log_debug(...) log_at(::logger::Level::Debug, __VA_ARGS__)
+#define log_info(...)  log_at(::logger::Level::Info, __VA_ARGS__)
+#define log_warn(...)  log_at(::logger::Level::Warn, __VA_ARGS__)
+#define log_error(...) log_at(::logger::Level::Error, __VA_ARGS__)
+
+// ensure, bail and unwrap of macros/unwrap.hpp print failures synchronously,
+// packet handlers use these instead so that malformed packets cannot block the event loop on stderr
+#define log_failure(...) log_warn(__FILE__, ":", __LINE__, " " __VA_OPT__(, ) __VA_ARGS__)
+
+#define log_bail(...)                 \
+    {                                 \
+        log_failure(__VA_ARGS__);     \
+        return {};                    \
+    }
+#define log_bail_v(...)               \
+    {                                 \
+        log_failure(__VA_ARGS__);     \
+        return;                       \
+    }
+#define log_ensure(cond, ...)         \
+    if(!(cond)) {                     \
+        log_bail(__VA_ARGS__);        \
+    }
+#define log_ensure_v(cond, ...)       \
+    if(!(cond)) {                     \
+        log_bail_v(__VA_ARGS__);      \
+    }
+#define log_unwrap(var, opt, ...)     \
+    auto var##_o = opt;               \
+    log_ensure(var##_o, __VA_ARGS__); \
+    auto& var = *var##_o;
@@ -0,0 +1,140 @@
+#include <chrono>
+#include <unordered_map>
+#include <utility>
+
+#include "capture.hpp"
+#include "logger.hpp"
+#include "loopback.hpp"
+#include "macros/unwrap.hpp"
+
+auto LoopbackTransport::to_connection(lws* const wsi) -> Connection& {
+    return *reinterpret_cast<Connection*>(wsi);
+}
+
+auto LoopbackTransport::free_session(Connection& connection) -> void {
+    if(connection.session != nullptr) {
+        initer->free(std::exchange(connection.session, nullptr));
+    }
+}
+
+auto LoopbackTransport::send(lws* const /*wsi*/, const std::span<const std::byte> payload) -> bool {
+    sent_packets += 1;
+    sent_bytes += payload.size();
+    return true;
+}
+
+auto LoopbackTransport::is_choked(lws* const /*wsi*/) -> bool {
+    return false;
+}
+
+auto LoopbackTransport::set_receiving(lws* const wsi, const bool enable) -> void {
+    to_connection(wsi).receiving = enable;
+}
+
+auto LoopbackTransport::request_writable(lws* const /*wsi*/) -> void {
+}
+
+auto LoopbackTransport::close(lws* const wsi) -> void {
+    auto& connection = to_connection(wsi);
+    if(!connection.closing) {
+        connection.closing = true;
+        closing.push_back(wsi);
+    }
+}
+
+auto LoopbackTransport::connect() -> lws* {
+    auto&      connection = *(new Connection());
+    const auto wsi        = reinterpret_cast<lws*>(&connection);
+    connection.session    = initer->alloc(wsi);
+    connections += 1;
+    return wsi;
+}
+
+auto LoopbackTransport::receive(lws* const wsi, const std::span<const std::byte> payload) -> bool {
+    auto& connection = to_connection(wsi);
+    if(connection.session == nullptr) {
+        return false;
+    }
+    server->handle_frame(wsi, *std::bit_cast<Session*>(connection.session), payload);
+    return true;
+}
+
+auto LoopbackTransport::disconnect(lws* const wsi) -> void {
+    auto& connection = to_connection(wsi);
+    free_session(connection);
+    std::erase(closing, wsi);
+    delete &connection;
+    connections -= 1;
+}
+
+auto LoopbackTransport::process() -> void {
+    // freeing a session may close other connections
+    while(!closing.empty()) {
+        for(const auto wsi : std::exchange(closing, {})) {
+            free_session(to_connection(wsi));
+        }
+    }
+}
+
+auto LoopbackTransport::replay(const char* const path, const uint32_t passes) -> bool {
+    auto reader = capture::Reader();
+    ensure(reader.open(path));
+
+    auto       records  = uint64_t(0);
+    auto       sessions = uint64_t(0);
+    auto       frames   = uint64_t(0);
+    auto       bytes    = uint64_t(0);
+    const auto start    = std::chrono::steady_clock::now();
+    for(auto pass = 0u; pass < passes; pass += 1) {
+        auto connections = std::unordered_map<uint32_t, lws*>();
+        reader.rewind();
+        while(const auto record = reader.next()) {
+            const auto& header = *record->header;
+            switch(header.kind) {
+            case capture::RecordKind::Open:
+                connections[header.session] = connect();
+                sessions += 1;
+                break;
+            case capture::RecordKind::Frame: {
+                const auto it = connections.find(header.session);
+                if(it == connections.end() || !receive(it->second, record->payload)) {
+                    break;
+                }
+                frames += 1;
+                bytes += record->payload.size();
+            } break;
+            case capture::RecordKind::Close:
+                if(const auto it = connections.find(header.session); it != connections.end()) {
+                    disconnect(it->second);
+                    connections.erase(it);
+                }
+                break;
+            }
+            process();
+            server->end_iteration({});
+            if(((records += 1) & 0x3ff) == 0) {
+                server->timers.advance();
+            }
+        }
+        // sessions still open at the end of the capture
+        for(const auto& [id, wsi] : connections) {
+            disconnect(wsi);
+        }
+    }
+    const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    print("replayed ", passes, " passes: ", sessions, " sessions, ", frames, " frames, ", bytes, " bytes in ", elapsed, " s");
+    print(frames / elapsed, " frames/s, ", sessions / elapsed, " sessions/s");
+    print("server sent ", sent_packets, " packets, ", sent_bytes, " bytes");
+    return true;
+}
+
+LoopbackTransport::LoopbackTransport(Server& server, std::unique_ptr<ws::server::SessionDataInitializer> initer)
+    : server(&server),
+      initer(std::move(initer)) {}
+
+LoopbackTransport::~LoopbackTransport() {
+    if(connections != 0) {
+        log_warn(connections, " loopback connections leaked");
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <memory>
+#include <vector>
+
+#include "server.hpp"
+
+// in-process transport driving sessions without sockets
+// connection handles are pointers to Connection disguised as lws*
+class LoopbackTransport : public Transport {
+  private:
+    struct Connection {
+        void* session; // nullptr after closed by the server
+        bool  receiving = true;
+        bool  closing   = false;
+    };
+
+    Server*                                             server;
+    std::unique_ptr<ws::server::SessionDataInitializer> initer;
+    std::vector<lws*>                                   closing;
+    size_t                                              connections  = 0;
+    uint64_t                                            sent_packets = 0; // from the server, discarded
+    uint64_t                                            sent_bytes   = 0;
+
+    static auto to_connection(lws* wsi) -> Connection&;
+    auto free_session(Connection& connection) -> void;
+
+  public:
+    auto send(lws* wsi, std::span<const std::byte> payload) -> bool override;
+    auto is_choked(lws* wsi) -> bool override;
+    auto set_receiving(lws* wsi, bool enable) -> void override;
+    auto request_writable(lws* wsi) -> void override;
+    auto close(lws* wsi) -> void override;
+
+    auto connect() -> lws*;
+    // frames are delivered even if receiving is paused, there is no one to push back
+    auto receive(lws* wsi, std::span<const std::byte> payload) -> bool;
+    // also required for connections closed by the server
+    auto disconnect(lws* wsi) -> void;
+    // free sessions of connections closed by the server
+    auto process() -> void;
+    // feed a capture file through loopback connections
+    auto replay(const char* path, uint32_t passes) -> bool;
+
+    LoopbackTransport(Server& server, std::unique_ptr<ws::server::SessionDataInitializer> initer);
+    ~LoopbackTransport();
+};
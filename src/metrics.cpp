@@ -0,0 +1,175 @@
+#include <bit>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "logger.hpp"
+#include "macros/unwrap.hpp"
+#include "metrics.hpp"
+
+namespace metrics {
+namespace {
+struct Descriptor {
+    const char* name;
+    const char* type;
+    const char* help;
+};
+
+const auto descriptors = std::array{
+    Descriptor{"p2p_sessions", "gauge", "live websocket sessions"},                                     // Sessions
+    Descriptor{"p2p_pads", "gauge", "registered pads"},                                                 // Pads
+    Descriptor{"p2p_links", "gauge", "linked pad pairs"},                                               // Links
+    Descriptor{"p2p_channels", "gauge", "registered channels"},                                         // Channels
+    Descriptor{"p2p_pending_requests", "gauge", "pad requests waiting for response"},                   // PendingRequests
+    Descriptor{"p2p_relay_queued_bytes", "gauge", "relayed bytes waiting for receivers"},               // RelayQueuedBytes
+    Descriptor{"p2p_handshaking_sessions", "gauge", "sessions not activated yet"},                      // Handshaking
+    Descriptor{"p2p_loop_lag_microseconds", "gauge", "smoothed delay of scheduled event loop wakeups"}, // LoopLag
+    Descriptor{"p2p_overloaded", "gauge", "1 while shedding new work"},                                 // Overloaded
+    Descriptor{"p2p_relayed_bytes_total", "counter", "relayed bytes"},                                  // RelayedBytes
+    Descriptor{"p2p_relayed_packets_total", "counter", "relayed packets"},                              // RelayedPackets
+    Descriptor{"p2p_activations_succeeded_total", "counter", "successful activations"},                 // ActivationSucceeded
+    Descriptor{"p2p_activations_failed_total", "counter", "failed activations"},                        // ActivationFailed
+    Descriptor{"p2p_shed_connections_total", "counter", "connections closed over the handshake limit"}, // ShedConnections
+    Descriptor{"p2p_shed_activations_total", "counter", "activations rejected while overloaded"},       // ShedActivations
+    Descriptor{"p2p_shed_registrations_total", "counter", "registrations rejected while overloaded"},   // ShedRegistrations
+};
+
+static_assert(Metric::Limit == descriptors.size());
+
+struct Registry {
+    std::mutex                          lock;
+    std::vector<std::unique_ptr<Shard>> shards;
+};
+
+auto registry = Registry();
+
+auto register_shard() -> Shard* {
+    auto guard = std::lock_guard(registry.lock);
+    return registry.shards.emplace_back(new Shard()).get();
+}
+
+auto append_histogram(std::string& out, const char* const name, const std::string& labels, const HistogramShard& merged) -> void {
+    auto cumulative = uint64_t(0);
+    for(auto i = 0; i < histogram_buckets; i += 1) {
+        cumulative += merged.buckets[i].get();
+        out += build_string(name, "_bucket{", labels, labels.empty() ? "" : ",", "le=\"", double(uint64_t(1) << i) / 1e6, "\"} ", cumulative, "\n");
+    }
+    cumulative += merged.buckets[histogram_buckets].get();
+    out += build_string(name, "_bucket{", labels, labels.empty() ? "" : ",", "le=\"+Inf\"} ", cumulative, "\n");
+    out += build_string(name, "_sum{", labels, "} ", double(merged.sum_us.get()) / 1e6, "\n");
+    out += build_string(name, "_count{", labels, "} ", cumulative, "\n");
+}
+
+auto serve(const int fd) -> void {
+    while(true) {
+        const auto client = accept(fd, nullptr, nullptr);
+        if(client < 0) {
+            continue;
+        }
+        // the request itself does not matter, every path returns the metrics
+        auto request = std::array<char, 1024>();
+        (void)read(client, request.data(), request.size());
+        const auto body     = render();
+        const auto response = build_string("HTTP/1.0 200 OK\r\n",
+                                           "Content-Type: text/plain; version=0.0.4\r\n",
+                                           "Content-Length: ", body.size(), "\r\n\r\n",
+                                           body);
+        for(auto sent = size_t(0); sent < response.size();) {
+            const auto n = write(client, response.data() + sent, response.size() - sent);
+            if(n <= 0) {
+                break;
+            }
+            sent += n;
+        }
+        close(client);
+    }
+}
+} // namespace
+
+auto local_shard() -> Shard& {
+    thread_local const auto shard = register_shard();
+    return *shard;
+}
+
+auto observe(const uint16_t histogram, const std::chrono::nanoseconds duration) -> void {
+    const auto us     = uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+    const auto bucket = us == 0 ? 0 : std::min(int(std::bit_width(us - 1)), histogram_buckets);
+    auto&      shard  = local_shard().histograms[histogram];
+    shard.buckets[bucket].add(1);
+    shard.sum_us.add(us);
+}
+
+auto render() -> std::string {
+    auto values     = std::array<int64_t, Metric::Limit>();
+    auto histograms = std::unique_ptr<std::array<HistogramShard, Histogram::Limit>>(new std::array<HistogramShard, Histogram::Limit>());
+    {
+        auto guard = std::lock_guard(registry.lock);
+        for(const auto& shard : registry.shards) {
+            for(auto i = 0; i < Metric::Limit; i += 1) {
+                values[i] += shard->values[i].get();
+            }
+            for(auto h = 0; h < Histogram::Limit; h += 1) {
+                auto& merged = (*histograms)[h];
+                for(auto b = 0; b <= histogram_buckets; b += 1) {
+                    merged.buckets[b].add(shard->histograms[h].buckets[b].get());
+                }
+                merged.sum_us.add(shard->histograms[h].sum_us.get());
+            }
+        }
+    }
+
+    auto out = std::string();
+    for(auto i = 0; i < Metric::Limit; i += 1) {
+        const auto& desc = descriptors[i];
+        out += build_string("# HELP ", desc.name, " ", desc.help, "\n# TYPE ", desc.name, " ", desc.type, "\n", desc.name, " ", values[i], "\n");
+    }
+    out += build_string("# HELP p2p_log_dropped_records_total log records dropped by the logger\n",
+                        "# TYPE p2p_log_dropped_records_total counter\n",
+                        "p2p_log_dropped_records_total ", logger::get().get_dropped(), "\n");
+
+    out += "# HELP p2p_verifier_seconds user certificate verification latency\n# TYPE p2p_verifier_seconds histogram\n";
+    append_histogram(out, "p2p_verifier_seconds", "", (*histograms)[Histogram::Verifier]);
+
+    out += "# HELP p2p_loop_iteration_seconds event loop busy time per iteration\n# TYPE p2p_loop_iteration_seconds histogram\n";
+    append_histogram(out, "p2p_loop_iteration_seconds", "", (*histograms)[Histogram::LoopIteration]);
+
+    out += "# HELP p2p_handle_payload_seconds packet handling time by message type\n# TYPE p2p_handle_payload_seconds histogram\n";
+    for(auto slot = 0; slot < Histogram::MessageTypes; slot += 1) {
+        const auto& merged = (*histograms)[Histogram::HandlePayload + slot];
+        auto        count  = uint64_t(0);
+        for(const auto& bucket : merged.buckets) {
+            count += bucket.get();
+        }
+        if(count == 0) {
+            continue;
+        }
+        const auto type = slot < Histogram::BaseTypes  ? std::to_string(slot)
+                          : slot < Histogram::OtherTypes ? std::to_string(p2p::proto::extension_types_begin + (slot - Histogram::BaseTypes))
+                                                         : std::string("other");
+        append_histogram(out, "p2p_handle_payload_seconds", build_string("type=\"", type, "\""), merged);
+    }
+    return out;
+}
+
+auto start_server(const uint16_t port) -> bool {
+    const auto fd = socket(AF_INET, SOCK_STREAM, 0);
+    ensure(fd >= 0, "failed to create metrics socket");
+    const auto yes = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    auto addr            = sockaddr_in();
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ensure(bind(fd, (sockaddr*)&addr, sizeof(addr)) == 0, "failed to bind metrics port ", port);
+    ensure(listen(fd, 8) == 0);
+    std::thread(serve, fd).detach();
+    log_info("serving metrics on 127.0.0.1:", port);
+    return true;
+}
+} // namespace metrics
@@ -0,0 +1,107 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include "protocol.hpp"
+
+namespace metrics {
+struct Metric {
+    enum : uint8_t {
+        // gauges
+        Sessions = 0,
+        Pads,
+        Links,
+        Channels,
+        PendingRequests,
+        RelayQueuedBytes,
+        Handshaking, // connections not activated yet
+        LoopLag,     // smoothed delay of scheduled event loop wakeups in microseconds
+        Overloaded,
+        // counters
+        RelayedBytes,
+        RelayedPackets,
+        ActivationSucceeded,
+        ActivationFailed,
+        ShedConnections,
+        ShedActivations,
+        ShedRegistrations,
+
+        Limit,
+    };
+};
+
+struct Histogram {
+    enum : uint8_t {
+        Verifier = 0,
+        LoopIteration,
+        HandlePayload, // + message type slot
+
+        // types below BaseTypes, then extension types from extension_types_begin, then one slot for the others
+        BaseTypes      = 48,
+        ExtensionTypes = 15,
+        OtherTypes     = BaseTypes + ExtensionTypes,
+        MessageTypes   = OtherTypes + 1,
+        Limit          = HandlePayload + MessageTypes,
+    };
+};
+
+// upper bound of bucket i is 2^i microseconds, the last one is +Inf
+constexpr auto histogram_buckets = 24;
+
+template <class T>
+struct Cell {
+    std::atomic<T> value = 0;
+
+    // only the owner thread writes, so no read-modify-write is needed
+    auto add(const T delta) -> void {
+        value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+
+    auto get() const -> T {
+        return value.load(std::memory_order_relaxed);
+    }
+};
+
+struct HistogramShard {
+    std::array<Cell<uint64_t>, histogram_buckets + 1> buckets;
+    Cell<uint64_t>                                    sum_us;
+};
+
+// per-thread storage, merged on scrape
+struct Shard {
+    std::array<Cell<int64_t>, Metric::Limit>     values;
+    std::array<HistogramShard, Histogram::Limit> histograms;
+};
+
+auto local_shard() -> Shard&;
+
+inline auto add(const uint8_t metric, const int64_t delta = 1) -> void {
+    local_shard().values[metric].add(delta);
+}
+
+auto observe(uint16_t histogram, std::chrono::nanoseconds duration) -> void;
+
+inline auto message_type_slot(const uint16_t type) -> uint16_t {
+    if(type < Histogram::BaseTypes) {
+        return type;
+    }
+    if(type >= ::p2p::proto::extension_types_begin && type - ::p2p::proto::extension_types_begin < Histogram::ExtensionTypes) {
+        return Histogram::BaseTypes + (type - ::p2p::proto::extension_types_begin);
+    }
+    return Histogram::OtherTypes;
+}
+
+inline auto observe_handle_payload(const uint16_t type, const std::chrono::nanoseconds duration) -> void {
+    observe(Histogram::HandlePayload + message_type_slot(type), duration);
+}
+
+// prometheus text exposition format
+auto render() -> std::string;
+
+// serve render() on 127.0.0.1:port from a background thread
+auto start_server(uint16_t port) -> bool;
+} // namespace metrics
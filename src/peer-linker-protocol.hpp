@@ -1,4 +1,6 @@
 #pragma once
+#include <cstddef>
+
 #include "protocol.hpp"
 
 namespace p2p::plink::proto {
@@ -17,6 +19,13 @@ struct Type {
         LinkAuthResponse,                     // server <-  client => (Success|Error) accept pad linking
 
         Limit,
+
+        // extensions, see ::p2p::proto::extension_types_begin
+        ResumeToken = ::p2p::proto::extension_types_begin, // server  -> client => () token to reattach the pad after reconnection
+        ResumeSession,                                      // server <-  client => (Success|Error) reattach detached pad instead of activation
+        AllocateUdpRelay,                                   // server <-  client => (Success|Error) ask server to relay datagrams of the link over udp
+        UdpRelayAllocated,                                  // server  -> client => () udp relay port and token, sent to both linked pads
+        PadExpired,                                         // server  -> client => () pad removed as it was not linked in time, register again
     };
 };
 
@@ -45,4 +54,36 @@ struct LinkAuthResponse : ::p2p::proto::Packet {
     uint16_t ok;
     // char requester_name[];
 };
+
+struct ResumeToken : ::p2p::proto::Packet {
+    // std::byte token[];
+};
+
+struct ResumeSession : ::p2p::proto::Packet {
+    // std::byte token[];
+};
+
+// unlike Unlinked, the pad itself is gone and its name may be taken by anyone
+struct PadExpired : ::p2p::proto::Packet {
+};
+
+struct AllocateUdpRelay : ::p2p::proto::Packet {
+};
+
+struct UdpRelayAllocated : ::p2p::proto::Packet {
+    uint16_t  port;
+    uint64_t  token;   // of this pad, in every datagram sent to the relay
+    std::byte key[32]; // of this pad, hmac-sha256 key of the datagram tags
+} __attribute__((packed));
+
+// datagram sent to the udp relay: [UdpRelayHeader][payload][tag]
+// tag is the first udp_relay_tag_size bytes of hmac-sha256(key, header and payload)
+// seq increases with each datagram, the relay drops replays and moves the endpoint only to the source of a newer one
+// the other side receives only the payload
+struct UdpRelayHeader {
+    uint64_t token;
+    uint64_t seq;
+} __attribute__((packed));
+
+constexpr auto udp_relay_tag_size = size_t(16);
 } // namespace p2p::plink::proto
@@ -1,3 +1,5 @@
+#include <cstdio>
+
 #include "peer-linker-session.hpp"
 #include "macros/unwrap.hpp"
 #include "peer-linker-protocol.hpp"
@@ -39,12 +41,20 @@ auto PeerLinkerSession::on_packet_received(const std::span<const std::byte> payl
         return true;
     }
     case proto::Type::LinkSuccess:
+        timeline.mark("link success");
         events.invoke(EventKind::Linked, no_id, 1);
         return true;
     case proto::Type::LinkDenied:
         line_warn("pad link authentication denied");
         stop();
         return true;
+    case proto::Type::PadExpired:
+        line_warn("pad expired before being linked");
+        stop();
+        return true;
+    case proto::Type::ResumeToken:
+        resume_token = p2p::proto::extract_last_string<proto::ResumeToken>(payload);
+        return true;
     default:
         return wss::WebSocketSession::on_packet_received(payload);
     }
@@ -63,8 +73,19 @@ auto PeerLinkerSession::start(const PeerLinkerSessionParams& params) -> bool {
 }
 
 auto PeerLinkerSession::start_plink(const PeerLinkerSessionParams& params) -> bool {
+    pad_name = params.pad_name;
+    timeline.mark("start");
+    if(!params.resume_token.empty()) {
+        // pad and link are kept by the server
+        ensure(send_packet(proto::Type::ResumeSession, params.resume_token));
+        resume_token = params.resume_token;
+        return true;
+    }
+
     ensure(send_packet(::p2p::proto::Type::ActivateSession, params.user_certificate));
+    timeline.mark("activate");
     ensure(send_packet(proto::Type::Register, params.pad_name));
+    timeline.mark("register");
     on_pad_created();
 
     const auto controlled = params.target_pad_name.empty();
@@ -75,9 +96,29 @@ auto PeerLinkerSession::start_plink(const PeerLinkerSessionParams& params) -> bo
                            uint16_t(secret.size()),
                            params.target_pad_name,
                            secret));
+        timeline.mark("link request");
     }
     unwrap(link_result, wait_for_event(EventKind::Linked));
     ensure(link_result == 1);
+    timeline.mark("linked");
+    return true;
+}
+
+auto PeerLinkerSession::get_resume_token() const -> const std::string& {
+    return resume_token;
+}
+
+auto PeerLinkerSession::export_trace(const char* const path) const -> bool {
+    auto events = "[\n" + trace::process_name_event(2, "client");
+    trace::append_chrome_events(events, timeline, 2, 1, pad_name);
+    events.resize(events.size() - 2); // remove last ",\n"
+    events += "\n]\n";
+
+    const auto file = std::fopen(path, "w");
+    ensure(file != nullptr, "failed to open trace file");
+    const auto written = std::fwrite(events.data(), 1, events.size(), file);
+    std::fclose(file);
+    ensure(written == events.size());
     return true;
 }
 
@@ -1,4 +1,5 @@
 #pragma once
+#include "trace.hpp"
 #include "websocket-session.hpp"
 
 namespace p2p::plink {
@@ -15,13 +16,20 @@ struct PeerLinkerSessionParams {
     std::string_view    pad_name;
     std::string_view    target_pad_name;
     std::string_view    user_certificate              = {};
+    std::string_view    resume_token                  = {}; // reattach to a detached pad instead of registering
     const char*         bind_address                  = nullptr;
     ws::KeepAliveParams keepalive                     = {};
     bool                peer_linker_allow_self_signed = false;
 };
 
 class PeerLinkerSession : public wss::WebSocketSession {
+  private:
+    std::string resume_token;
+    std::string pad_name;
+
   protected:
+    trace::Timeline timeline;
+
     virtual auto on_pad_created() -> void;
     virtual auto get_auth_secret() -> std::vector<std::byte>;
     virtual auto auth_peer(std::string_view peer_name, std::span<const std::byte> secret) -> bool;
@@ -30,6 +38,10 @@ class PeerLinkerSession : public wss::WebSocketSession {
   public:
     auto start(const PeerLinkerSessionParams& params) -> bool;
     auto start_plink(const PeerLinkerSessionParams& params) -> bool;
+    // empty if the server does not support session resumption
+    auto get_resume_token() const -> const std::string&;
+    // write link setup timeline in chrome trace event format
+    auto export_trace(const char* path) const -> bool;
 
     virtual ~PeerLinkerSession();
 };
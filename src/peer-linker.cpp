@@ -1,15 +1,39 @@
+#include <array>
+#include <random>
+#include <utility>
+
+#include "logger.hpp"
 #include "macros/unwrap.hpp"
+#include "metrics.hpp"
 #include "peer-linker-protocol.hpp"
 #include "server.hpp"
+#include "udp-relay.hpp"
 #include "util/string-map.hpp"
 
 namespace p2p::plink {
 namespace {
+struct PeerLinkerSession;
+
 struct Pad {
-    std::string name;
-    std::string authenticator_name;
-    lws*        wsi    = nullptr;
-    Pad*        linked = nullptr;
+    std::string               name;
+    std::string               authenticator_name;
+    lws*                      wsi             = nullptr; // nullptr while detached
+    PeerLinkerSession*        session         = nullptr; // of wsi
+    Pad*                      linked          = nullptr;
+    User*                     user            = nullptr; // owner, counted while the pad exists
+    uint64_t                  udp_relay_token = 0;       // of this pad, 0 without udp relay allocation
+    std::array<std::byte, 32> udp_relay_key;             // of this pad, valid with udp_relay_token
+
+    // session resumption
+    std::string                         resume_token;
+    std::vector<std::vector<std::byte>> backlog; // packets sent to this pad while detached
+    size_t                              backlog_size = 0;
+
+    Timer resume_timer; // armed while detached
+    Timer auth_timer;   // armed while authenticator_name is set
+    Timer idle_timer;   // armed while not linked
+
+    trace::Timeline timeline;
 };
 
 struct Error {
@@ -25,6 +49,12 @@ struct Error {
         AuthInProgress,
         AuthNotInProgress,
         AutherMismatched,
+        AlreadyActivated,
+        InvalidResumeToken,
+        Overloaded,
+        PadQuota,
+        RelayQuota,
+        UdpRelayDisabled,
 
         Limit,
     };
@@ -42,22 +72,153 @@ const auto estr = std::array{
     "another authentication in progress",    // AuthInProgress
     "pad not authenticating",                // AuthNotInProgress
     "authenticator mismatched",              // AutherMismatched
+    "session already activated",             // AlreadyActivated
+    "no such resumable pad",                 // InvalidResumeToken
+    "server overloaded",                     // Overloaded
+    "too many pads of user",                 // PadQuota
+    "relay rate of user exceeded",           // RelayQuota
+    "udp relay is disabled",                 // UdpRelayDisabled
 };
 
 static_assert(Error::Limit == estr.size());
 
+constexpr auto resume_token_size      = 16;
+constexpr auto detached_backlog_limit = size_t(1024 * 1024);
+
 struct PeerLinker : Server {
-    StringMap<Pad> pads;
+    StringMap<Pad>     pads;
+    StringMap<Pad*>    resumable_pads; // resume token -> pad, of every pad with a token
+    std::random_device token_source;
+    UdpRelay           udp_relay; // started on the first allocation
+
+    // from: sender of relayed packet, nullptr for server generated ones
+    // server generated packets change the link state, so they stay behind the relayed packets before them
+    auto send_to_pad(Pad& pad, const std::span<const std::byte> payload, lws* const from = nullptr) -> bool {
+        if(pad.wsi != nullptr) {
+            return from != nullptr ? relay(from, pad.wsi, payload) : send_ordered(pad.wsi, payload);
+        }
+        // owner is reconnecting, keep the packet until it resumes
+        log_ensure(pad.backlog_size + payload.size() <= detached_backlog_limit, "backlog of detached pad ", pad.name, " is full");
+        pad.backlog.emplace_back(payload.begin(), payload.end());
+        pad.backlog_size += payload.size();
+        return true;
+    }
+
+    template <class... Args>
+    auto send_to_pad(Pad& pad, const uint16_t type, const uint32_t id, Args... args) -> bool {
+        return send_to_pad(pad, p2p::proto::build_packet(type, id, args...));
+    }
+
+    auto issue_resume_token() -> std::string {
+        auto token = std::string(resume_token_size, '\0');
+        for(auto i = 0; i < resume_token_size; i += sizeof(uint32_t)) {
+            const auto r = uint32_t(token_source());
+            std::memcpy(token.data() + i, &r, sizeof(r));
+        }
+        return token;
+    }
+
+    auto detach_pad(Pad* const pad) -> void {
+        log_info("detaching pad ", pad->name);
+        pad->wsi     = nullptr;
+        pad->session = nullptr;
+        timers.arm(pad->resume_timer, resume_grace, [this, pad] {
+            log_info("detached pad ", pad->name, " expired");
+            remove_pad(pad);
+        });
+    }
+
+    // also takes the pad over from a stale connection which is not closed yet
+    auto attach_pad(std::string_view token, PeerLinkerSession& session) -> Pad*;
+
+    auto arm_idle_timer(Pad& pad) -> void {
+        if(idle_pad_timeout.count() > 0) {
+            timers.arm(pad.idle_timer, idle_pad_timeout, [this, &pad] { expire_idle_pad(pad); });
+        }
+    }
+
+    auto arm_auth_timer(Pad& pad) -> void {
+        if(link_auth_timeout.count() > 0) {
+            timers.arm(pad.auth_timer, link_auth_timeout, [this, &pad] {
+                log_info("link authentication from ", pad.name, " to ", pad.authenticator_name, " timed out");
+                pad.authenticator_name.clear();
+                send_to_pad(pad, proto::Type::LinkDenied, 0);
+            });
+        }
+    }
+
+    auto expire_idle_pad(Pad& pad) -> void;
+
+    // pad must be linked
+    auto allocate_udp_relay(Pad& pad) -> bool {
+        if(pad.udp_relay_token == 0) {
+            if(!udp_relay.is_running()) {
+                log_ensure(udp_relay.start(udp_relay_port));
+            }
+            // charged to the same buckets as the websocket relay
+            const auto bucket_of = [](Pad& pad) { return pad.user != nullptr ? &pad.user->relay : nullptr; };
+            log_unwrap(credentials, udp_relay.allocate(user_limits.relay_rate, bucket_of(pad), bucket_of(*pad.linked)));
+            pad.udp_relay_token         = credentials.first.token;
+            pad.udp_relay_key           = credentials.first.key;
+            pad.linked->udp_relay_token = credentials.second.token;
+            pad.linked->udp_relay_key   = credentials.second.key;
+            log_info("udp relay allocated for ", pad.name, " and ", pad.linked->name);
+            log_ensure(send_udp_relay_allocated(*pad.linked));
+        }
+        // sent again if already allocated, the peer may have asked first
+        log_ensure(send_udp_relay_allocated(pad));
+        return true;
+    }
+
+    auto send_udp_relay_allocated(Pad& pad) -> bool {
+        return send_to_pad(pad, proto::Type::UdpRelayAllocated, 0, udp_relay.get_port(), pad.udp_relay_token, std::span<const std::byte>(pad.udp_relay_key));
+    }
+
+    // call before unlinking
+    auto release_udp_relay(Pad& pad) -> void {
+        if(pad.udp_relay_token == 0) {
+            return;
+        }
+        udp_relay.release(pad.udp_relay_token);
+        pad.udp_relay_token = 0;
+        if(pad.linked != nullptr) {
+            pad.linked->udp_relay_token = 0;
+        }
+    }
+
+    auto trace_mark(Pad& pad, const char* const name) -> void {
+        if(trace_file) {
+            pad.timeline.mark(name);
+        }
+    }
+
+    // called when a link setup is over
+    auto flush_trace(Pad& pad) -> void {
+        if(trace_file && !pad.timeline.empty()) {
+            write_trace(pad.timeline, pad.name);
+            pad.timeline.clear();
+        }
+    }
 
     auto remove_pad(Pad* pad) -> void {
         if(pad == nullptr) {
             return;
         }
+        flush_trace(*pad);
+        release_udp_relay(*pad);
         if(pad->linked) {
-            send_to(pad->linked->wsi, proto::Type::Unlinked, 0);
+            send_to_pad(*pad->linked, proto::Type::Unlinked, 0);
             pad->linked->linked = nullptr;
+            arm_idle_timer(*pad->linked);
+            metrics::add(metrics::Metric::Links, -1);
+        }
+        if(!pad->resume_token.empty()) {
+            resumable_pads.erase(pad->resume_token);
         }
+        const auto user = pad->user;
         pads.erase(pad->name);
+        release_quota(user, &User::pads);
+        metrics::add(metrics::Metric::Pads, -1);
     }
 };
 
@@ -65,119 +226,268 @@ struct PeerLinkerSession : Session {
     PeerLinker* server;
     lws*        wsi;
     Pad*        pad = nullptr;
+    std::string resume_token;
+    int64_t     activated_at = 0;
+
+    // forwards a packet to the linked pad as is
+    auto passthrough(std::span<const std::byte> payload) -> bool;
 
     auto handle_payload(std::span<const std::byte> payload) -> bool override;
+    auto is_relayed(uint16_t type) const -> bool override;
+    auto relay_fragment(std::span<const std::byte> fragment) -> bool override;
+    auto find_secret(std::span<const std::byte> payload) const -> std::span<const std::byte> override;
 };
 
+auto PeerLinkerSession::passthrough(const std::span<const std::byte> payload) -> bool {
+    log_ensure(pad != nullptr, estr[Error::NotRegistered]);
+    log_ensure(pad->linked != nullptr, estr[Error::NotLinked]);
+    if(!server->consume_relay_quota(user, payload.size())) {
+        error_code = ::p2p::proto::ErrorCode::RelayQuota;
+        log_bail(estr[Error::RelayQuota]);
+    }
+
+    log_debug("passthroughing packet from ", pad->name, " to ", pad->linked->name,
+              " queued: ", server->get_queue_depth(pad->linked->wsi).bytes, " bytes");
+
+    log_ensure(server->send_to_pad(*pad->linked, payload, wsi));
+    metrics::add(metrics::Metric::RelayedPackets);
+    metrics::add(metrics::Metric::RelayedBytes, payload.size());
+    return true;
+}
+
+auto PeerLinkerSession::is_relayed(const uint16_t type) const -> bool {
+    // types beyond the peer-linker protocol belong to the clients
+    return type >= proto::Type::Limit && type < ::p2p::proto::extension_types_begin;
+}
+
+auto PeerLinkerSession::relay_fragment(const std::span<const std::byte> fragment) -> bool {
+    log_ensure(activated, estr[Error::NotActivated]);
+    return passthrough(fragment);
+}
+
+auto PeerLinkerSession::find_secret(const std::span<const std::byte> payload) const -> std::span<const std::byte> {
+    const auto header = p2p::proto::extract_header(payload);
+    if(header == nullptr) {
+        return {};
+    }
+    switch(header->type) {
+    case proto::Type::ResumeSession:
+        return payload.subspan(sizeof(proto::ResumeSession));
+    case proto::Type::Link:
+        // the requestee name is kept
+        if(const auto link = p2p::proto::extract_payload<proto::Link>(payload); link != nullptr) {
+            const auto offset = std::min(sizeof(proto::Link) + link->requestee_name_len, payload.size());
+            return payload.subspan(offset);
+        }
+        return {};
+    default:
+        return Session::find_secret(payload);
+    }
+}
+
+auto PeerLinker::attach_pad(const std::string_view token, PeerLinkerSession& session) -> Pad* {
+    const auto it = resumable_pads.find(token);
+    if(it == resumable_pads.end()) {
+        return nullptr;
+    }
+    auto& pad = *it->second;
+    if(pad.session != nullptr) {
+        // the client reconnected before the old connection was noticed to be dead
+        log_info("taking pad ", pad.name, " over from stale connection ", pad.wsi);
+        pad.session->pad = nullptr;
+        transport->close(pad.wsi);
+    } else {
+        pad.resume_timer.cancel();
+    }
+    pad.wsi     = session.wsi;
+    pad.session = &session;
+    return &pad;
+}
+
+auto PeerLinker::expire_idle_pad(Pad& pad) -> void {
+    log_info("pad ", pad.name, " was not linked in time");
+    if(pad.session != nullptr) {
+        // notify the owner that its pad is gone, Unlinked would mean that the peer left
+        pad.session->pad = nullptr;
+        send_to_pad(pad, proto::Type::PadExpired, 0);
+    }
+    remove_pad(&pad);
+}
+
 auto PeerLinkerSession::handle_payload(const std::span<const std::byte> payload) -> bool {
-    unwrap(header, p2p::proto::extract_header(payload));
+    log_unwrap(header, p2p::proto::extract_header(payload));
 
     if(header.type == ::p2p::proto::Type::ActivateSession) {
         const auto cert = p2p::proto::extract_last_string<proto::Register>(payload);
-        print("received activate session");
-        ensure(activate(*server, cert), "failed to verify user certificate");
-        print("session activated");
+        log_debug("received activate session");
+        log_ensure(activate(*server, cert), "failed to verify user certificate");
+        log_info("session activated");
+        activated_at = trace::now();
+        if(server->resume_grace.count() > 0) {
+            resume_token = server->issue_resume_token();
+            log_ensure(server->send_to(wsi, proto::Type::ResumeToken, 0, std::string_view(resume_token)));
+        }
         goto finish;
+    } else if(header.type == proto::Type::ResumeSession) {
+        const auto token = p2p::proto::extract_last_string<proto::ResumeSession>(payload);
+        log_debug("received resume session");
+
+        log_ensure(!activated, estr[Error::AlreadyActivated]);
+        log_unwrap(resumed, server->attach_pad(token, *this), estr[Error::InvalidResumeToken]);
+
+        log_info("pad ", resumed.name, " resumed");
+        set_activated(*server);
+        // the pad kept the user alive
+        server->acquire_quota(resumed.user, &User::sessions, nullptr);
+        user         = resumed.user;
+        pad          = &resumed;
+        resume_token = pad->resume_token;
+        log_ensure(server->send_to(wsi, ::p2p::proto::Type::Success, header.id));
+        // the senders may be gone, the limits apply without pausing them
+        for(const auto& packet : std::exchange(pad->backlog, {})) {
+            log_ensure(server->relay(nullptr, wsi, packet));
+        }
+        pad->backlog_size = 0;
+        return true;
     } else {
-        ensure(activated, estr[Error::NotActivated]);
+        log_ensure(activated, estr[Error::NotActivated]);
     }
 
     switch(header.type) {
     case proto::Type::Register: {
         const auto name = p2p::proto::extract_last_string<proto::Register>(payload);
-        print("received pad register request name: ", name);
-
-        ensure(!name.empty(), estr[Error::EmptyPadName]);
-        ensure(pad == nullptr, estr[Error::AlreadyRegistered]);
-        ensure(server->pads.find(name) == server->pads.end(), estr[Error::PadFound]);
+        log_debug("received pad register request name: ", name);
+
+        log_ensure(!name.empty(), estr[Error::EmptyPadName]);
+        log_ensure(pad == nullptr, estr[Error::AlreadyRegistered]);
+        log_ensure(server->pads.find(name) == server->pads.end(), estr[Error::PadFound]);
+        if(!server->admit(metrics::Metric::ShedRegistrations)) {
+            error_code = ::p2p::proto::ErrorCode::Overloaded;
+            log_bail(estr[Error::Overloaded]);
+        }
+        if(!server->acquire_quota(user, &User::pads, &UserLimits::pads)) {
+            error_code = ::p2p::proto::ErrorCode::PadQuota;
+            log_bail(estr[Error::PadQuota]);
+        }
 
-        print("pad ", name, " registerd");
-        pad = &server->pads.insert(std::pair{name, Pad{std::string(name), "", wsi, nullptr}}).first->second;
+        log_info("pad ", name, " registerd");
+        pad               = &server->pads.try_emplace(std::string(name)).first->second;
+        pad->name         = name;
+        pad->user         = user;
+        pad->wsi          = wsi;
+        pad->session      = this;
+        pad->resume_token = resume_token;
+        if(!resume_token.empty()) {
+            server->resumable_pads.insert(std::pair{resume_token, pad});
+        }
+        server->arm_idle_timer(*pad);
+        if(server->trace_file) {
+            pad->timeline.mark("activate", activated_at);
+            pad->timeline.mark("register");
+        }
+        metrics::add(metrics::Metric::Pads);
     } break;
     case proto::Type::Unregister: {
-        print("received unregister request");
+        log_debug("received unregister request");
 
-        ensure(pad != nullptr, estr[Error::NotRegistered]);
+        log_ensure(pad != nullptr, estr[Error::NotRegistered]);
 
-        print("unregistering pad ", pad->name);
+        log_info("unregistering pad ", pad->name);
         server->remove_pad(pad);
         pad = nullptr;
     } break;
     case proto::Type::Link: {
-        unwrap(packet, p2p::proto::extract_payload<proto::Link>(payload));
-        ensure(sizeof(proto::Link) + packet.requestee_name_len + packet.secret_len == payload.size());
+        log_unwrap(packet, p2p::proto::extract_payload<proto::Link>(payload));
+        log_ensure(sizeof(proto::Link) + packet.requestee_name_len + packet.secret_len == payload.size());
         const auto requestee_name = std::string_view(std::bit_cast<char*>(payload.data() + sizeof(proto::Link)), packet.requestee_name_len);
         const auto secret         = std::span(payload.data() + sizeof(proto::Link) + packet.requestee_name_len, packet.secret_len);
-        print("received pad link request to ", requestee_name);
+        log_debug("received pad link request to ", requestee_name);
+        if(pad != nullptr) {
+            server->trace_mark(*pad, "link request");
+        }
 
-        ensure(pad != nullptr, estr[Error::NotRegistered]);
-        ensure(pad->linked == nullptr, estr[Error::AlreadyLinked]);
-        ensure(pad->authenticator_name.empty(), estr[Error::AuthInProgress]);
+        log_ensure(pad != nullptr, estr[Error::NotRegistered]);
+        log_ensure(pad->linked == nullptr, estr[Error::AlreadyLinked]);
+        log_ensure(pad->authenticator_name.empty(), estr[Error::AuthInProgress]);
         const auto it = server->pads.find(requestee_name);
-        ensure(it != server->pads.end(), estr[Error::PadNotFound]);
+        log_ensure(it != server->pads.end(), estr[Error::PadNotFound]);
         auto& requestee = it->second;
 
-        print("sending auth request from ", pad->name, " to ", requestee_name);
-        ensure(server->send_to(requestee.wsi, proto::Type::LinkAuth, 0,
-                               uint16_t(pad->name.size()),
-                               uint16_t(secret.size()),
-                               pad->name,
-                               secret));
+        log_info("sending auth request from ", pad->name, " to ", requestee_name);
+        log_ensure(server->send_to_pad(requestee, proto::Type::LinkAuth, 0,
+                                       uint16_t(pad->name.size()),
+                                       uint16_t(secret.size()),
+                                       pad->name,
+                                       secret));
         pad->authenticator_name = requestee.name;
+        server->arm_auth_timer(*pad);
+        server->trace_mark(*pad, "link auth sent");
     } break;
     case proto::Type::Unlink: {
-        print("received unlink request");
+        log_debug("received unlink request");
 
-        ensure(pad != nullptr, estr[Error::NotRegistered]);
-        ensure(pad->linked != nullptr, estr[Error::NotLinked]);
+        log_ensure(pad != nullptr, estr[Error::NotRegistered]);
+        log_ensure(pad->linked != nullptr, estr[Error::NotLinked]);
 
-        print("unlinking pad ", pad->name, " and ", pad->linked->name);
-        ensure(server->send_to(pad->linked->wsi, proto::Type::Unlinked, 0));
+        log_info("unlinking pad ", pad->name, " and ", pad->linked->name);
+        server->release_udp_relay(*pad);
+        log_ensure(server->send_to_pad(*pad->linked, proto::Type::Unlinked, 0));
+        server->arm_idle_timer(*pad->linked);
+        server->arm_idle_timer(*pad);
         pad->linked->linked = nullptr;
         pad->linked         = nullptr;
+        metrics::add(metrics::Metric::Links, -1);
     } break;
     case proto::Type::LinkAuthResponse: {
-        unwrap(packet, p2p::proto::extract_payload<proto::LinkAuthResponse>(payload));
+        log_unwrap(packet, p2p::proto::extract_payload<proto::LinkAuthResponse>(payload));
         const auto requester_name = p2p::proto::extract_last_string<proto::LinkAuthResponse>(payload);
-        print("received link auth to name: ", requester_name, " ok: ", int(packet.ok));
+        log_debug("received link auth to name: ", requester_name, " ok: ", int(packet.ok));
 
-        ensure(pad != nullptr, estr[Error::NotRegistered]);
+        log_ensure(pad != nullptr, estr[Error::NotRegistered]);
 
         const auto it = server->pads.find(requester_name);
-        ensure(it != server->pads.end(), estr[Error::PadNotFound]);
+        log_ensure(it != server->pads.end(), estr[Error::PadNotFound]);
         auto& requester = it->second;
-        ensure(!requester.authenticator_name.empty(), estr[Error::AuthNotInProgress]);
-        ensure(pad->name == requester.authenticator_name, estr[Error::AutherMismatched]);
+        log_ensure(!requester.authenticator_name.empty(), estr[Error::AuthNotInProgress]);
+        log_ensure(pad->name == requester.authenticator_name, estr[Error::AutherMismatched]);
 
-        pad->authenticator_name.clear();
+        requester.authenticator_name.clear();
+        requester.auth_timer.cancel();
+        server->trace_mark(requester, "link auth response");
         if(packet.ok == 0) {
-            ensure(server->send_to(requester.wsi, proto::Type::LinkDenied, header.id));
+            log_ensure(server->send_to_pad(requester, proto::Type::LinkDenied, header.id));
+            server->trace_mark(requester, "link denied");
+            server->flush_trace(requester);
         } else {
-            print("linking ", pad->name, " and ", requester.name);
-            ensure(server->send_to(requester.wsi, proto::Type::LinkSuccess, 0));
+            log_info("linking ", pad->name, " and ", requester.name);
+            log_ensure(server->send_to_pad(requester, proto::Type::LinkSuccess, 0));
             pad->linked      = &requester;
             requester.linked = pad;
+            pad->idle_timer.cancel();
+            requester.idle_timer.cancel();
+            metrics::add(metrics::Metric::Links);
+            server->trace_mark(requester, "link success");
+            server->trace_mark(*pad, "link success");
+            server->flush_trace(requester);
+            server->flush_trace(*pad);
         }
     } break;
-    default: {
-        if(server->verbose) {
-            print("received general command ", int(header.type));
-        }
-
-        ensure(pad != nullptr, estr[Error::NotRegistered]);
-        ensure(pad->linked != nullptr, estr[Error::NotLinked]);
-
-        if(server->verbose) {
-            print("passthroughing packet from ", pad->name, " to ", pad->linked->name);
-        }
+    case proto::Type::AllocateUdpRelay: {
+        log_debug("received udp relay allocation request");
 
-        ensure(server->websocket_context.send(pad->linked->wsi, payload));
-        return true;
+        log_ensure(pad != nullptr, estr[Error::NotRegistered]);
+        log_ensure(pad->linked != nullptr, estr[Error::NotLinked]);
+        log_ensure(server->udp_relay_port != 0, estr[Error::UdpRelayDisabled]);
+        log_ensure(server->allocate_udp_relay(*pad));
+    } break;
+    default: {
+        log_debug("received general command ", int(header.type));
+        return passthrough(payload);
     }
     }
 
 finish:
-    ensure(server->send_to(wsi, ::p2p::proto::Type::Success, header.id));
+    log_ensure(server->send_to(wsi, ::p2p::proto::Type::Success, header.id));
     return true;
 }
 
@@ -188,15 +498,22 @@ struct SessionDataInitializer : ws::server::SessionDataInitializer {
         auto& session  = *(new PeerLinkerSession());
         session.server = server;
         session.wsi    = wsi;
-        print("session created: ", &session);
+        log_info("session created: ", &session);
+        metrics::add(metrics::Metric::Sessions);
         return &session;
     }
 
     auto free(void* ptr) -> void override {
         auto& session = *std::bit_cast<PeerLinkerSession*>(ptr);
-        server->remove_pad(session.pad);
+        server->close_outbox(session.wsi);
+        if(session.pad != nullptr && !session.resume_token.empty()) {
+            server->detach_pad(session.pad);
+        } else {
+            server->remove_pad(session.pad);
+        }
         delete &session;
-        print("session destroyed: ", &session);
+        log_info("session destroyed: ", &session);
+        metrics::add(metrics::Metric::Sessions, -1);
     }
 
     SessionDataInitializer(PeerLinker& server)
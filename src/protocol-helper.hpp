@@ -12,7 +12,9 @@ inline auto extract_header(const std::span<const std::byte> payload) -> const Pa
         return nullptr;
     }
     const auto& header = *std::bit_cast<proto::Packet*>(payload.data());
-    if(header.size != payload.size()) {
+    // reassembled from fragments
+    const auto extended = header.size == 0 && payload.size() > max_packet_size;
+    if(header.size != payload.size() && !extended) {
         return nullptr;
     }
     return &header;
@@ -28,8 +30,8 @@ auto extract_payload(const std::span<const std::byte> payload) -> const T* {
 
 template <class T>
 auto extract_last_string(const std::span<const std::byte> payload) -> std::string_view {
-    const auto header = *std::bit_cast<proto::Packet*>(payload.data());
-    return std::string_view((char*)(payload.data() + sizeof(T)), header.size - sizeof(T));
+    // the header size is checked by extract_header, and is 0 for extended packets
+    return std::string_view((char*)(payload.data() + sizeof(T)), payload.size() - sizeof(T));
 }
 
 template <std::integral T>
@@ -64,7 +66,8 @@ template <class... Args>
 inline auto build_packet(uint16_t type, uint32_t id, Args... args) -> std::vector<std::byte> {
     auto buffer = std::vector<std::byte>(sizeof(Packet));
     add_parameters(buffer, args...);
-    *(std::bit_cast<Packet*>(buffer.data())) = Packet{uint16_t(buffer.size()), type, id};
+    const auto size                          = buffer.size() <= max_packet_size ? uint16_t(buffer.size()) : uint16_t(0);
+    *(std::bit_cast<Packet*>(buffer.data())) = Packet{size, type, id};
     return buffer;
 }
 } // namespace p2p::proto
@@ -9,17 +9,53 @@ struct Type {
         ActivateSession,
 
         Limit,
+
+        Fragment = 0xffff, // fixed so that no type is renumbered, above every extension
+    };
+};
+
+// types added to a deployed protocol take values from here up instead of moving its Limit,
+// which would renumber every type of the protocols derived from it
+constexpr auto extension_types_begin = uint16_t(0xff00);
+
+struct ErrorCode {
+    enum : uint16_t {
+        Unspecified = 0,
+        Overloaded,
+        SessionQuota,
+        PadQuota,
+        ChannelQuota,
+        RequestQuota,
+        RelayQuota,
+
+        Limit,
     };
 };
 
 struct Packet {
-    uint16_t size; // total size in bytes, including this header
+    uint16_t size; // total size in bytes, including this header, 0 if larger than max_packet_size
     uint16_t type;
     uint32_t id;
 } __attribute__((packed));
 
+// larger packets are sent as a series of Fragment packets
+constexpr auto max_packet_size = size_t(0xffff);
+
+struct Error : ::p2p::proto::Packet {
+    // uint16_t code; ErrorCode, omitted if unspecified
+};
+
 struct ActivateSession : ::p2p::proto::Packet {
     // char user_certificate[];
 };
 
+// piece of a packet larger than max_packet_size, the first one starts with the packet header
+// fragments of a packet are sent in order and may interleave with other packets
+// id is chosen at random by the sender of the packet, to tell interleaved packets apart
+struct Fragment : ::p2p::proto::Packet {
+    uint32_t total_size; // of the whole packet
+    uint32_t offset;     // of this piece in the whole packet
+    // std::byte data[];
+} __attribute__((packed));
+
 } // namespace p2p::proto
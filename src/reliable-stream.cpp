@@ -0,0 +1,449 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <optional>
+
+#include "reliable-stream.hpp"
+
+namespace p2p::ice {
+namespace {
+struct DataHeader {
+    uint8_t  kind;
+    uint32_t seq; // sequence numbers do not wrap, 2^32 segments are enough for any session
+    uint32_t ts;  // sender clock in microseconds
+} __attribute__((packed));
+
+struct AckHeader {
+    uint8_t  kind;
+    uint32_t cumulative; // every segment below is received
+    uint32_t echo_ts;    // ts of the latest received segment
+    uint32_t ack_delay;  // microseconds since it was received
+    uint8_t  blocks;
+    // SackBlock blocks[];
+} __attribute__((packed));
+
+struct SackBlock {
+    uint32_t begin;
+    uint32_t end;
+} __attribute__((packed));
+
+constexpr auto max_sack_blocks  = size_t(16);
+constexpr auto cubic_c          = 0.4;
+constexpr auto cubic_beta       = 0.7;
+constexpr auto min_cwnd         = 2.0;
+constexpr auto hystart_min_cwnd = 16.0;
+constexpr auto max_rto_backoff  = uint32_t(6);
+constexpr auto initial_rtt      = std::chrono::microseconds(std::chrono::milliseconds(100));
+constexpr auto max_rto          = std::chrono::microseconds(std::chrono::seconds(2));
+constexpr auto pacing_quantum   = std::chrono::milliseconds(1); // burst allowed after idle, bounds wakeups
+
+template <class T>
+auto read_header(const std::span<const std::byte> datagram) -> std::optional<T> {
+    if(datagram.size() < sizeof(T)) {
+        return std::nullopt;
+    }
+    auto header = T();
+    std::memcpy(&header, datagram.data(), sizeof(T));
+    return header;
+}
+} // namespace
+
+auto ReliableStream::now_us(const Clock::time_point now) const -> uint32_t {
+    return uint32_t(std::chrono::duration_cast<std::chrono::microseconds>(now - epoch).count());
+}
+
+auto ReliableStream::rto() const -> std::chrono::microseconds {
+    const auto base = srtt.count() == 0 ? initial_rtt * 2 : srtt + std::max(rttvar * 4, std::chrono::microseconds(1000));
+    return std::min(std::max(base, params.min_rto) * (1 << rto_backoff), max_rto);
+}
+
+auto ReliableStream::pacing_interval(const size_t bytes) const -> Clock::duration {
+    const auto rtt  = std::chrono::duration<double>(srtt.count() == 0 ? initial_rtt : srtt).count();
+    const auto gain = cwnd < ssthresh ? 2.0 : 1.25;
+    const auto rate = cwnd * max_payload * gain / rtt; // bytes per second
+    return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(bytes / rate));
+}
+
+auto ReliableStream::on_acked(const uint32_t count, const Clock::time_point now) -> void {
+    if(cwnd < ssthresh) {
+        cwnd = std::min(cwnd + count, double(params.max_window));
+        return;
+    }
+    if(!epoch_started) {
+        epoch_started = true;
+        epoch_start   = now;
+        if(cwnd < w_max) {
+            cubic_k = std::cbrt((w_max - cwnd) / cubic_c);
+        } else {
+            cubic_k = 0;
+            w_max   = cwnd;
+        }
+        w_est = cwnd;
+    }
+    const auto rtt    = min_rtt == std::chrono::microseconds::max() ? initial_rtt : min_rtt;
+    const auto t      = std::chrono::duration<double>(now - epoch_start + rtt).count();
+    const auto target = std::min(w_max + cubic_c * std::pow(t - cubic_k, 3), cwnd * 1.5);
+    w_est += count * 3 * (1 - cubic_beta) / (1 + cubic_beta) / cwnd;
+    if(target > cwnd) {
+        cwnd += count * (target - cwnd) / cwnd;
+    } else {
+        cwnd += count * 0.01 / cwnd;
+    }
+    cwnd = std::min(std::max(cwnd, w_est), double(params.max_window));
+}
+
+auto ReliableStream::on_congestion(const Clock::time_point now) -> void {
+    recovery_start = now;
+    epoch_started  = false;
+    // fast convergence, release bandwidth for new flows
+    w_max    = cwnd < w_max ? cwnd * (1 + cubic_beta) / 2 : cwnd;
+    cwnd     = std::max(cwnd * cubic_beta, min_cwnd);
+    ssthresh = cwnd;
+}
+
+auto ReliableStream::mark_lost(Segment& segment, const uint32_t seq) -> void {
+    segment.inflight = false;
+    segment.lost     = true;
+    inflight -= 1;
+    retransmit_queue.push_back(seq);
+}
+
+auto ReliableStream::send_ack(const Clock::time_point now) -> void {
+    auto datagram = std::vector<std::byte>(sizeof(AckHeader));
+    auto blocks   = uint8_t(0);
+    for(auto it = out_of_order.begin(); it != out_of_order.end() && blocks < max_sack_blocks; blocks += 1) {
+        auto block = SackBlock{it->first, it->first + 1};
+        for(it = std::next(it); it != out_of_order.end() && it->first == block.end; it = std::next(it)) {
+            block.end += 1;
+        }
+        const auto prev_size = datagram.size();
+        datagram.resize(prev_size + sizeof(SackBlock));
+        std::memcpy(datagram.data() + prev_size, &block, sizeof(SackBlock));
+    }
+    const auto header = AckHeader{
+        .kind       = ack_kind,
+        .cumulative = rcv_next,
+        .echo_ts    = latest_ts,
+        .ack_delay  = uint32_t(std::chrono::duration_cast<std::chrono::microseconds>(now - latest_recv).count()),
+        .blocks     = blocks,
+    };
+    std::memcpy(datagram.data(), &header, sizeof(AckHeader));
+    transmit(datagram);
+    unacked     = 0;
+    ack_pending = false;
+}
+
+auto ReliableStream::send_segment(const uint32_t seq, const Clock::time_point now) -> void {
+    auto&      segment = segments[seq - base_seq];
+    const auto ts      = now_us(now);
+    std::memcpy(segment.datagram.data() + offsetof(DataHeader, ts), &ts, sizeof(ts));
+    if(inflight == 0) {
+        last_progress = now;
+    }
+    // a failed send is detected as a loss later
+    transmit(segment.datagram);
+    segment.sent_at = now;
+    segment.transmissions += 1;
+    segment.inflight = true;
+    segment.lost     = false;
+    inflight += 1;
+    stats.segments_sent += 1;
+    stats.retransmits += segment.transmissions > 1 ? 1 : 0;
+}
+
+auto ReliableStream::handle_data(const std::span<const std::byte> datagram, std::vector<std::vector<std::byte>>& delivered, std::span<const std::byte>& direct) -> void {
+    const auto header_o = read_header<DataHeader>(datagram);
+    if(!header_o) {
+        return;
+    }
+    const auto& header  = *header_o;
+    const auto  payload = datagram.subspan(sizeof(DataHeader));
+    const auto  now     = Clock::now();
+    latest_ts           = header.ts;
+    latest_recv         = now;
+    unacked += 1;
+
+    auto ack_now = false;
+    if(header.seq < rcv_next || out_of_order.contains(header.seq)) {
+        // our ack was lost or late
+        ack_now = true;
+    } else if(header.seq >= rcv_next + params.max_window) {
+        return;
+    } else if(header.seq == rcv_next) {
+        direct   = payload;
+        rcv_next += 1;
+        stats.bytes_delivered += payload.size();
+        for(auto it = out_of_order.begin(); it != out_of_order.end() && it->first == rcv_next; it = out_of_order.erase(it)) {
+            stats.bytes_delivered += it->second.size();
+            delivered.push_back(std::move(it->second));
+            rcv_next += 1;
+        }
+        // let the sender know about the remaining holes quickly
+        ack_now = !out_of_order.empty();
+    } else {
+        out_of_order.emplace(header.seq, std::vector<std::byte>(payload.begin(), payload.end()));
+        ack_now = true;
+    }
+
+    if(ack_now || unacked >= 2) {
+        send_ack(now);
+    } else if(!ack_pending) {
+        ack_pending  = true;
+        ack_deadline = now + params.ack_delay;
+        worker_condvar.notify_one();
+    }
+}
+
+auto ReliableStream::handle_ack(const std::span<const std::byte> datagram) -> void {
+    const auto header_o = read_header<AckHeader>(datagram);
+    if(!header_o || datagram.size() < sizeof(AckHeader) + header_o->blocks * sizeof(SackBlock)) {
+        return;
+    }
+    const auto& header = *header_o;
+    const auto  now    = Clock::now();
+
+    if(const auto sample = int64_t(uint32_t(now_us(now) - header.echo_ts)) - header.ack_delay; sample > 0 && sample < 10'000'000) {
+        const auto rtt = std::chrono::microseconds(sample);
+        if(srtt.count() == 0) {
+            srtt   = rtt;
+            rttvar = rtt / 2;
+        } else {
+            rttvar = (rttvar * 3 + (srtt > rtt ? srtt - rtt : rtt - srtt)) / 4;
+            srtt   = (srtt * 7 + rtt) / 8;
+        }
+        min_rtt = std::min(min_rtt, rtt);
+        // leave slow start once queues start to build, as in hystart
+        const auto threshold = std::clamp(min_rtt / 8, std::chrono::microseconds(4000), std::chrono::microseconds(16000));
+        if(cwnd < ssthresh && cwnd >= hystart_min_cwnd && rtt > min_rtt + threshold) {
+            ssthresh = cwnd;
+        }
+    }
+
+    // only segments that were sent can be acked
+    const auto sent_end    = base_seq + next_new;
+    auto       newly       = uint32_t(0);
+    auto       newest_sent = Clock::time_point();
+    const auto ack_range   = [&](const uint32_t begin, const uint32_t end) {
+        for(auto seq = std::max(begin, base_seq); seq < std::min(end, sent_end); seq += 1) {
+            auto& segment = segments[seq - base_seq];
+            if(segment.acked) {
+                continue;
+            }
+            segment.acked = true;
+            segment.lost  = false;
+            if(segment.inflight) {
+                segment.inflight = false;
+                inflight -= 1;
+            }
+            newly += 1;
+            newest_sent = std::max(newest_sent, segment.sent_at);
+        }
+    };
+    ack_range(base_seq, header.cumulative);
+    for(auto i = 0u; i < header.blocks; i += 1) {
+        auto block = SackBlock();
+        std::memcpy(&block, datagram.data() + sizeof(AckHeader) + i * sizeof(SackBlock), sizeof(SackBlock));
+        ack_range(block.begin, block.end);
+    }
+    if(newly == 0) {
+        return;
+    }
+    while(!segments.empty() && segments.front().acked) {
+        buffered -= segments.front().datagram.size() - sizeof(DataHeader);
+        segments.pop_front();
+        base_seq += 1;
+        next_new -= 1;
+    }
+    last_progress = now;
+    rto_backoff   = 0;
+    rack_sent_at  = std::max(rack_sent_at, newest_sent);
+    on_acked(newly, now);
+
+    // segments sent well before a delivered one are lost
+    // first transmissions are in sequence order, so the scan stops at the first one that is not lost yet
+    const auto reorder = std::max(srtt / 4, std::chrono::microseconds(1000));
+    for(auto i = uint32_t(0); i < next_new; i += 1) {
+        auto& segment = segments[i];
+        if(!segment.inflight) {
+            continue;
+        }
+        if(segment.sent_at + reorder >= rack_sent_at) {
+            if(segment.transmissions == 1) {
+                break;
+            }
+            continue;
+        }
+        if(segment.sent_at > recovery_start) {
+            on_congestion(now);
+        }
+        mark_lost(segment, base_seq + i);
+    }
+
+    writable_condvar.notify_all();
+    worker_condvar.notify_one();
+}
+
+auto ReliableStream::service(const Clock::time_point now) -> Clock::time_point {
+    auto next = Clock::time_point::max();
+    if(ack_pending) {
+        if(now >= ack_deadline) {
+            send_ack(now);
+        } else {
+            next = ack_deadline;
+        }
+    }
+
+    if(inflight > 0 && now >= last_progress + rto()) {
+        stats.timeouts += 1;
+        for(auto i = uint32_t(0); i < next_new; i += 1) {
+            if(segments[i].inflight) {
+                mark_lost(segments[i], base_seq + i);
+            }
+        }
+        on_congestion(now);
+        cwnd          = min_cwnd;
+        rto_backoff   = std::min(rto_backoff + 1, max_rto_backoff);
+        last_progress = now;
+    }
+
+    while(true) {
+        while(!retransmit_queue.empty()) {
+            const auto seq = retransmit_queue.front();
+            if(seq >= base_seq && segments[seq - base_seq].lost) {
+                break;
+            }
+            retransmit_queue.pop_front();
+        }
+        const auto can_send_new = next_new < segments.size() && next_new < params.max_window;
+        if((retransmit_queue.empty() && !can_send_new) || inflight >= uint32_t(cwnd)) {
+            break;
+        }
+        if(now < next_send) {
+            next = std::min(next, next_send);
+            break;
+        }
+        auto seq = uint32_t(0);
+        if(!retransmit_queue.empty()) {
+            seq = retransmit_queue.front();
+            retransmit_queue.pop_front();
+        } else {
+            seq = base_seq + next_new;
+            next_new += 1;
+        }
+        send_segment(seq, now);
+        next_send = std::max(next_send, now - pacing_quantum) + pacing_interval(segments[seq - base_seq].datagram.size());
+    }
+
+    if(inflight > 0) {
+        next = std::min(next, last_progress + rto());
+    }
+    return next;
+}
+
+auto ReliableStream::worker_main() -> void {
+    auto guard = std::unique_lock(lock);
+    while(!stopping) {
+        const auto next = service(Clock::now());
+        if(next == Clock::time_point::max()) {
+            worker_condvar.wait(guard);
+        } else {
+            worker_condvar.wait_until(guard, next);
+        }
+    }
+}
+
+auto ReliableStream::start(StreamParams params, const uint8_t data_kind, const uint8_t ack_kind, Transmit transmit, OnData on_data) -> void {
+    this->params    = params;
+    this->data_kind = data_kind;
+    this->ack_kind  = ack_kind;
+    this->transmit  = std::move(transmit);
+    this->on_data   = std::move(on_data);
+    max_payload     = params.max_datagram_size - sizeof(DataHeader);
+    epoch           = Clock::now();
+    next_send       = epoch;
+    last_progress   = epoch;
+    recovery_start  = epoch;
+    worker          = std::thread(&ReliableStream::worker_main, this);
+}
+
+auto ReliableStream::stop() -> void {
+    {
+        auto guard = std::lock_guard(lock);
+        stopping   = true;
+        worker_condvar.notify_all();
+        writable_condvar.notify_all();
+    }
+    if(worker.joinable()) {
+        worker.join();
+    }
+}
+
+auto ReliableStream::write(std::span<const std::byte> data) -> bool {
+    auto guard = std::unique_lock(lock);
+    while(!data.empty()) {
+        writable_condvar.wait(guard, [this] { return stopping || buffered < params.send_buffer_size; });
+        if(stopping) {
+            return false;
+        }
+        // small writes are appended to the last segment while it is not sent
+        if(next_new == segments.size() || segments.back().datagram.size() == sizeof(DataHeader) + max_payload) {
+            const auto header = DataHeader{.kind = data_kind, .seq = uint32_t(base_seq + segments.size()), .ts = 0};
+            auto&      tail   = segments.emplace_back().datagram;
+            tail.reserve(sizeof(DataHeader) + max_payload);
+            tail.resize(sizeof(DataHeader));
+            std::memcpy(tail.data(), &header, sizeof(DataHeader));
+        }
+        auto&      tail = segments.back().datagram;
+        const auto size = std::min(data.size(), sizeof(DataHeader) + max_payload - tail.size());
+        tail.insert(tail.end(), data.begin(), data.begin() + size);
+        buffered += size;
+        stats.bytes_written += size;
+        data = data.subspan(size);
+        worker_condvar.notify_one();
+    }
+    return true;
+}
+
+auto ReliableStream::flush() -> bool {
+    auto guard = std::unique_lock(lock);
+    writable_condvar.wait(guard, [this] { return stopping || segments.empty(); });
+    return !stopping;
+}
+
+auto ReliableStream::on_datagram(const std::span<const std::byte> datagram) -> void {
+    if(datagram.empty()) {
+        return;
+    }
+    auto delivered = std::vector<std::vector<std::byte>>();
+    auto direct    = std::span<const std::byte>();
+    {
+        auto guard = std::lock_guard(lock);
+        if(stopping) {
+            return;
+        }
+        if(uint8_t(datagram[0]) == data_kind) {
+            handle_data(datagram, delivered, direct);
+        } else if(uint8_t(datagram[0]) == ack_kind) {
+            handle_ack(datagram);
+        }
+    }
+    if(!direct.empty()) {
+        on_data(direct);
+    }
+    for(const auto& payload : delivered) {
+        on_data(payload);
+    }
+}
+
+auto ReliableStream::get_stats() -> StreamStats {
+    auto guard  = std::lock_guard(lock);
+    auto result = stats;
+    result.cwnd = cwnd;
+    result.srtt = srtt;
+    return result;
+}
+
+ReliableStream::~ReliableStream() {
+    stop();
+}
+} // namespace p2p::ice
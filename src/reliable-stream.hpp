@@ -0,0 +1,137 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+namespace p2p::ice {
+struct StreamParams {
+    size_t                    max_datagram_size = 1200;              // including headers, must fit the path mtu
+    size_t                    send_buffer_size  = 8 * 1024 * 1024;   // write blocks while this many bytes are unacked
+    uint32_t                  max_window        = 8192;              // segments, bounds out of order data kept by the receiver
+    std::chrono::microseconds ack_delay         = std::chrono::milliseconds(2);
+    std::chrono::microseconds min_rto           = std::chrono::milliseconds(20);
+};
+
+struct StreamStats {
+    uint64_t                  bytes_written   = 0;
+    uint64_t                  bytes_delivered = 0;
+    uint64_t                  segments_sent   = 0;
+    uint64_t                  retransmits     = 0;
+    uint64_t                  timeouts        = 0;
+    double                    cwnd            = 0; // segments
+    std::chrono::microseconds srtt            = {};
+};
+
+// reliable ordered byte stream over an unreliable datagram path
+// segments carry a sequence number and are acked with a cumulative sequence and sack blocks,
+// losses are detected by time (rack) and retransmission timeout, the window follows cubic and sends are paced
+//
+// datagrams are prefixed with data_kind or ack_kind so that they can share a path with other traffic
+// on_datagram must not be called concurrently, received data is passed to on_data in order from that thread
+class ReliableStream {
+  public:
+    // returns false if the datagram could not be sent, it is then treated as lost
+    using Transmit = std::function<bool(std::span<const std::byte> datagram)>;
+    // payload points into the received datagram or the reassembly buffer, valid only during the call
+    using OnData = std::function<void(std::span<const std::byte> payload)>;
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Segment {
+        std::vector<std::byte> datagram; // header and payload
+        Clock::time_point      sent_at;
+        uint32_t               transmissions = 0;
+        bool                   inflight      = false;
+        bool                   acked         = false;
+        bool                   lost          = false; // queued for retransmission
+    };
+
+    StreamParams params;
+    Transmit     transmit;
+    OnData       on_data;
+    uint8_t      data_kind;
+    uint8_t      ack_kind;
+    size_t       max_payload;
+
+    std::mutex              lock;
+    std::condition_variable worker_condvar;
+    std::condition_variable writable_condvar;
+    std::thread             worker;
+    bool                    stopping = false;
+    Clock::time_point       epoch;
+
+    // sender
+    std::deque<Segment>  segments; // from the oldest unacked one
+    uint32_t             base_seq      = 0;
+    uint32_t             next_new      = 0; // index in segments of the first segment never sent
+    size_t               buffered      = 0; // bytes in segments
+    uint32_t             inflight      = 0;
+    std::deque<uint32_t> retransmit_queue;
+    Clock::time_point    rack_sent_at; // send time of the most recently sent segment known to be delivered
+    Clock::time_point    last_progress;
+    uint32_t             rto_backoff = 0;
+
+    // rtt
+    std::chrono::microseconds srtt    = {};
+    std::chrono::microseconds rttvar  = {};
+    std::chrono::microseconds min_rtt = std::chrono::microseconds::max();
+
+    // cubic, in segments
+    double            cwnd     = 10;
+    double            ssthresh = 1e9;
+    double            w_max    = 0;
+    double            cubic_k  = 0;
+    double            w_est    = 0; // reno friendly estimate
+    Clock::time_point epoch_start;
+    bool              epoch_started = false;
+    Clock::time_point recovery_start;
+
+    // pacer
+    Clock::time_point next_send;
+
+    // receiver
+    uint32_t                                   rcv_next = 0;
+    std::map<uint32_t, std::vector<std::byte>> out_of_order; // payloads
+    uint32_t                                   latest_ts   = 0;
+    Clock::time_point                          latest_recv = {};
+    uint32_t                                   unacked     = 0;
+    Clock::time_point                          ack_deadline;
+    bool                                       ack_pending = false;
+
+    StreamStats stats;
+
+    auto now_us(Clock::time_point now) const -> uint32_t;
+    auto rto() const -> std::chrono::microseconds;
+    auto pacing_interval(size_t bytes) const -> Clock::duration;
+    auto on_acked(uint32_t count, Clock::time_point now) -> void;
+    auto on_congestion(Clock::time_point now) -> void;
+    auto mark_lost(Segment& segment, uint32_t seq) -> void;
+    auto send_ack(Clock::time_point now) -> void;
+    auto send_segment(uint32_t seq, Clock::time_point now) -> void;
+    auto handle_data(std::span<const std::byte> datagram, std::vector<std::vector<std::byte>>& delivered, std::span<const std::byte>& direct) -> void;
+    auto handle_ack(std::span<const std::byte> datagram) -> void;
+    // sends what is allowed now, returns when to be called again
+    auto service(Clock::time_point now) -> Clock::time_point;
+    auto worker_main() -> void;
+
+  public:
+    auto start(StreamParams params, uint8_t data_kind, uint8_t ack_kind, Transmit transmit, OnData on_data) -> void;
+    auto stop() -> void;
+    // blocks while the send buffer is full, false if stopped
+    auto write(std::span<const std::byte> data) -> bool;
+    // blocks until everything written is acked, false if stopped
+    auto flush() -> bool;
+    auto on_datagram(std::span<const std::byte> datagram) -> void;
+    auto get_stats() -> StreamStats;
+
+    ~ReliableStream();
+};
+} // namespace p2p::ice
@@ -1,9 +1,16 @@
+#include <algorithm>
 #include <cstdint>
 #include <filesystem>
 #include <optional>
 #include <string_view>
+#include <utility>
 
+#include <libwebsockets.h>
+
+#include "logger.hpp"
+#include "loopback.hpp"
 #include "macros/unwrap.hpp"
+#include "metrics.hpp"
 #include "protocol-helper.hpp"
 #include "server.hpp"
 #include "util/argument-parser.hpp"
@@ -16,40 +23,606 @@
 #include "spawn/process.hpp"
 #endif
 
-auto Session::activate(Server& server, const std::string_view cert) -> bool {
+namespace {
+// returns verified content, empty if verification is disabled
+auto verify_user_certificate(Server& server, const std::string_view cert) -> std::optional<std::string_view> {
     if(auto& key = server.session_key) {
-        unwrap(parsed, key->split_user_certificate_to_hash_and_content(cert));
+        log_unwrap(parsed, key->split_user_certificate_to_hash_and_content(cert));
         const auto [hash_str, content] = parsed;
-        ensure(key->verify_user_certificate_hash(hash_str, content));
+        log_ensure(key->verify_user_certificate_hash(hash_str, content));
 
         if(!server.user_cert_verifier.empty()) {
+            const auto start = std::chrono::steady_clock::now();
+
             auto cont = std::string(content);
             auto args = std::vector<const char*>{server.user_cert_verifier.data(), cont.data(), nullptr};
 
             auto process      = process::Process();
-            auto on_output    = [](const std::span<const char> output) { std::cout << "verifier: " << std::string_view(output.data(), output.size()); };
+            auto on_output    = [](const std::span<const char> output) { log_info("verifier: ", std::string_view(output.data(), output.size())); };
             process.on_stdout = on_output;
             process.on_stderr = on_output;
-            ensure(process.start({.argv = args, .die_on_parent_exit = true}), "failed to launch verifier");
+            log_ensure(process.start({.argv = args, .die_on_parent_exit = true}), "failed to launch verifier");
             while(process.get_status() == process::Status::Running) {
                 process.collect_outputs();
             }
-            unwrap(result, process.join());
-            ensure(result.reason == process::Result::ExitReason::Exit, "verifier exitted abnormally");
-            ensure(result.code == 0, "verifier returned non-zero code: ", result.code);
+            log_unwrap(result, process.join());
+            log_ensure(result.reason == process::Result::ExitReason::Exit, "verifier exitted abnormally");
+            metrics::observe(metrics::Histogram::Verifier, std::chrono::steady_clock::now() - start);
+            log_ensure(result.code == 0, "verifier returned non-zero code: ", result.code);
+        }
+        return content;
+    }
+    return std::string_view();
+}
+
+// value of the "user=" line
+auto find_user_name(std::string_view content) -> std::string_view {
+    while(!content.empty()) {
+        const auto lf   = content.find('\n');
+        const auto line = content.substr(0, lf);
+        if(line.starts_with("user=")) {
+            return line.substr(5);
+        }
+        content = lf == content.npos ? std::string_view() : content.substr(lf + 1);
+    }
+    return {};
+}
+
+// records connection lifecycles for the capture file
+struct CapturingInitializer : ws::server::SessionDataInitializer {
+    std::unique_ptr<ws::server::SessionDataInitializer> initer;
+    capture::Writer*                                    capture;
+
+    auto alloc(lws* const wsi) -> void* override {
+        const auto ptr = initer->alloc(wsi);
+        capture->on_open(ptr);
+        return ptr;
+    }
+
+    auto free(void* const ptr) -> void override {
+        capture->on_close(ptr);
+        initer->free(ptr);
+    }
+
+    CapturingInitializer(std::unique_ptr<ws::server::SessionDataInitializer> initer, capture::Writer& capture)
+        : initer(std::move(initer)),
+          capture(&capture) {}
+};
+
+// counts connections not activated yet and closes ones over the limit
+struct AdmissionInitializer : ws::server::SessionDataInitializer {
+    std::unique_ptr<ws::server::SessionDataInitializer> initer;
+    Server*                                             server;
+
+    auto alloc(lws* const wsi) -> void* override {
+        server->transport->on_open(wsi);
+        const auto ptr = initer->alloc(wsi);
+        server->handshaking += 1;
+        metrics::add(metrics::Metric::Handshaking);
+        // idle connections must not hold handshake slots forever
+        if(const auto timeout = server->admission.handshake_timeout; timeout.count() > 0) {
+            server->timers.arm(std::bit_cast<Session*>(ptr)->handshake_timer, timeout, [server = server, wsi] {
+                log_info("session of ", wsi, " not activated in time, closing");
+                server->transport->close(wsi);
+            });
+        }
+        if(const auto limit = server->admission.max_handshakes; limit != 0 && server->handshaking > limit) {
+            log_warn("too many sessions in handshake, closing ", wsi);
+            metrics::add(metrics::Metric::ShedConnections);
+            server->transport->close(wsi);
+        }
+        return ptr;
+    }
+
+    auto free(void* const ptr) -> void override {
+        const auto& session = *std::bit_cast<Session*>(ptr);
+        if(!session.activated) {
+            server->handshaking -= 1;
+            metrics::add(metrics::Metric::Handshaking, -1);
+        }
+        // released after the session frees its resources
+        const auto user = session.user;
+        initer->free(ptr);
+        server->release_quota(user, &User::sessions);
+    }
+
+    AdmissionInitializer(std::unique_ptr<ws::server::SessionDataInitializer> initer, Server& server)
+        : initer(std::move(initer)),
+          server(&server) {}
+};
+
+struct WebSocketTransport : Transport {
+    ws::server::Context*   context;
+    lws_context*           lws_ctx = nullptr; // learned from the first connection
+    lws_sorted_usec_list_t wakeup  = {};
+
+    auto send(lws* const wsi, const std::span<const std::byte> payload) -> bool override {
+        return context->send(wsi, payload);
+    }
+
+    auto is_choked(lws* const wsi) -> bool override {
+        return lws_send_pipe_choked(wsi);
+    }
+
+    auto set_receiving(lws* const wsi, const bool enable) -> void override {
+        lws_rx_flow_control(wsi, enable ? 1 : 0);
+    }
+
+    auto request_writable(lws* const wsi) -> void override {
+        lws_callback_on_writable(wsi);
+    }
+
+    auto close(lws* const wsi) -> void override {
+        lws_set_timeout(wsi, PENDING_TIMEOUT_USER_OK, LWS_TO_KILL_ASYNC);
+    }
+
+    auto on_open(lws* const wsi) -> void override {
+        if(lws_ctx == nullptr) {
+            lws_ctx = lws_get_context(wsi);
+        }
+    }
+
+    auto wake_at(const std::chrono::steady_clock::time_point time) -> void override {
+        // timers only exist after a connection was opened
+        if(lws_ctx == nullptr) {
+            return;
+        }
+        const auto delay = std::chrono::duration_cast<std::chrono::microseconds>(time - std::chrono::steady_clock::now());
+        // lws_service returns after running the ripe callback, which has nothing else to do
+        lws_sul_schedule(lws_ctx, 0, &wakeup, [](lws_sorted_usec_list_t*) {}, std::max(delay.count(), int64_t(0)));
+    }
+
+    WebSocketTransport(ws::server::Context& context)
+        : context(&context) {}
+
+    // must be called before the context is destroyed, the wakeup is linked into it
+    auto detach() -> void {
+        if(lws_ctx != nullptr) {
+            lws_sul_cancel(&wakeup);
+            lws_ctx = nullptr;
+        }
+    }
+
+    ~WebSocketTransport() {
+        detach();
+    }
+};
+} // namespace
+
+auto Session::activate(Server& server, const std::string_view cert) -> bool {
+    if(!server.admit(metrics::Metric::ShedActivations)) {
+        error_code = p2p::proto::ErrorCode::Overloaded;
+        log_bail("server overloaded");
+    }
+    const auto content = verify_user_certificate(server, cert);
+    metrics::add(content ? metrics::Metric::ActivationSucceeded : metrics::Metric::ActivationFailed);
+    log_ensure(content);
+    if(const auto name = find_user_name(*content); !name.empty() && user == nullptr) {
+        const auto new_user = server.acquire_user(name);
+        if(!server.acquire_quota(new_user, &User::sessions, &UserLimits::sessions)) {
+            server.erase_user_if_idle(new_user);
+            error_code = p2p::proto::ErrorCode::SessionQuota;
+            log_bail("too many sessions of user ", name);
+        }
+        user = new_user;
+    }
+    set_activated(server);
+    return true;
+}
+
+auto Session::find_secret(const std::span<const std::byte> payload) const -> std::span<const std::byte> {
+    const auto header = p2p::proto::extract_header(payload);
+    if(header != nullptr && header->type == p2p::proto::Type::ActivateSession) {
+        return payload.subspan(sizeof(p2p::proto::ActivateSession));
+    }
+    return {};
+}
+
+auto Session::set_activated(Server& server) -> void {
+    if(std::exchange(activated, true)) {
+        return;
+    }
+    handshake_timer.cancel();
+    server.handshaking -= 1;
+    metrics::add(metrics::Metric::Handshaking, -1);
+}
+
+namespace {
+// relayed bytes handed to a connection per round
+constexpr auto flush_quantum = size_t(64 * 1024);
+// the loop wakes itself up this often to measure how late it runs
+constexpr auto lag_probe_interval = std::chrono::milliseconds(50);
+} // namespace
+
+auto Server::handle_frame(lws* const wsi, Session& session, const std::span<const std::byte> payload) -> void {
+    const auto start = std::chrono::steady_clock::now();
+    log_debug("session ", &session, ": ", "received ", payload.size(), " bytes");
+    if(const auto header = p2p::proto::extract_header(payload); header != nullptr && header->type == p2p::proto::Type::Fragment) {
+        // not answered, the id is not a request id
+        // captured by handle_fragment, where secrets of reassembled packets can be found
+        if(!handle_fragment(wsi, session, payload)) {
+            log_warn("fragment handling failed");
+        }
+    } else {
+        capture_frame(session, payload);
+        handle_packet(wsi, session, payload);
+    }
+    frame_work += std::chrono::steady_clock::now() - start;
+}
+
+auto Server::capture_frame(const Session& session, const std::span<const std::byte> payload) -> void {
+    if(capture.is_open()) {
+        capture.on_frame(&session, payload, capture_secrets ? std::span<const std::byte>() : session.find_secret(payload));
+    }
+}
+
+auto Server::handle_packet(lws* const wsi, Session& session, const std::span<const std::byte> payload) -> void {
+    const auto start   = std::chrono::steady_clock::now();
+    const auto handled = session.handle_payload(payload);
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    if(const auto header = p2p::proto::extract_header(payload); header != nullptr) {
+        metrics::observe_handle_payload(header->type, elapsed);
+    }
+    if(!handled) {
+        log_warn("payload handling failed");
+
+        const auto& header_o = p2p::proto::extract_header(payload);
+        const auto  id       = header_o != nullptr ? header_o->id : 0;
+        if(!header_o) {
+            log_warn("packet too short");
+        }
+        if(const auto code = std::exchange(session.error_code, 0); code != p2p::proto::ErrorCode::Unspecified) {
+            log_ensure_v(send_to(wsi, p2p::proto::Type::Error, id, code));
+        } else {
+            log_ensure_v(send_to(wsi, p2p::proto::Type::Error, id));
+        }
+        // free the handshake slot, the client has to reconnect anyway
+        if(header_o != nullptr && header_o->type == p2p::proto::Type::ActivateSession && !session.activated) {
+            transport->close(wsi);
+        }
+    }
+}
+
+auto Server::handle_fragment(lws* const wsi, Session& session, const std::span<const std::byte> payload) -> bool {
+    log_unwrap(fragment, p2p::proto::extract_payload<p2p::proto::Fragment>(payload));
+    const auto data = payload.subspan(sizeof(p2p::proto::Fragment));
+    const auto last = fragment.offset + data.size() >= fragment.total_size;
+
+    // forward packets between clients without buffering them whole
+    if(fragment.offset == 0) {
+        log_unwrap(header, p2p::proto::extract_payload<p2p::proto::Packet>(data));
+        if(session.is_relayed(header.type)) {
+            if(!last) {
+                // the rest of an evicted packet goes to the reassembler, which drops it for the missing head
+                if(session.relayed_fragments.size() >= reassembly_pool.limits.max_pending) {
+                    session.relayed_fragments.erase(session.relayed_fragments.begin());
+                }
+                session.relayed_fragments.push_back(fragment.id);
+            }
+            // relayed types carry no credentials of the server
+            capture_frame(session, payload);
+            return session.relay_fragment(payload);
+        }
+    } else if(const auto it = std::ranges::find(session.relayed_fragments, fragment.id); it != session.relayed_fragments.end()) {
+        if(last) {
+            session.relayed_fragments.erase(it);
+        }
+        capture_frame(session, payload);
+        return session.relay_fragment(payload);
+    }
+
+    // captured whole once reassembled, replayed as one extended packet
+    return session.reassembler.feed(reassembly_pool, payload, [this, wsi, &session](const std::span<const std::byte> packet) {
+        capture_frame(session, packet);
+        handle_packet(wsi, session, packet);
+        return true;
+    });
+}
+
+auto Server::send(lws* const wsi, const std::span<const std::byte> payload) -> bool {
+    if(payload.size() > p2p::proto::max_packet_size) {
+        return p2p::proto::for_each_fragment(payload, [this, wsi](const std::span<const std::byte> fragment) { return send(wsi, fragment); });
+    }
+    if(const auto it = outboxes.find(wsi); it != outboxes.end() && !it->second.empty()) {
+        // overtake relayed packets, but keep order with other control packets
+        return queue_control(wsi, it->second, payload);
+    }
+    if(transport->is_choked(wsi)) {
+        return queue_control(wsi, outboxes[wsi], payload);
+    }
+    return transport->send(wsi, payload);
+}
+
+auto Server::queue_control(lws* const wsi, Outbox& outbox, const std::span<const std::byte> payload) -> bool {
+    if(outbox.closing) {
+        outbox.dropped += 1;
+        return true;
+    }
+    if(outbox.control_bytes + payload.size() > relay_limits.control_limit) {
+        // a client sending requests without reading the replies would grow this without bound
+        log_warn("control queue of ", wsi, " exceeded ", relay_limits.control_limit, " bytes, disconnecting");
+        disconnect_receiver(wsi, outbox);
+        return true;
+    }
+    outbox.control.emplace_back(payload.begin(), payload.end());
+    outbox.control_bytes += payload.size();
+    return true;
+}
+
+auto Server::disconnect_receiver(lws* const wsi, Outbox& outbox) -> void {
+    transport->close(wsi);
+    metrics::add(metrics::Metric::RelayQueuedBytes, -int64_t(outbox.bytes));
+    outbox.closing = true;
+    outbox.dropped += outbox.control.size() + outbox.bulk.size() + 1;
+    outbox.control.clear();
+    outbox.bulk.clear();
+    outbox.bytes         = 0;
+    outbox.control_bytes = 0;
+}
+
+auto Server::send_ordered(lws* const wsi, const std::span<const std::byte> payload) -> bool {
+    if(payload.size() > p2p::proto::max_packet_size) {
+        return p2p::proto::for_each_fragment(payload, [this, wsi](const std::span<const std::byte> fragment) { return send_ordered(wsi, fragment); });
+    }
+    const auto it = outboxes.find(wsi);
+    if(it == outboxes.end() || it->second.bulk.empty()) {
+        return send(wsi, payload);
+    }
+    auto& outbox = it->second;
+    if(!outbox.closing) {
+        outbox.bulk.emplace_back(payload.begin(), payload.end());
+        outbox.bytes += payload.size();
+        metrics::add(metrics::Metric::RelayQueuedBytes, payload.size());
+    }
+    return true;
+}
+
+auto Server::relay(lws* const from, lws* const to, const std::span<const std::byte> payload) -> bool {
+    if(payload.size() > p2p::proto::max_packet_size) {
+        return p2p::proto::for_each_fragment(payload, [this, from, to](const std::span<const std::byte> fragment) { return relay(from, to, fragment); });
+    }
+    auto it = outboxes.find(to);
+    if((it == outboxes.end() || it->second.empty()) && !transport->is_choked(to)) {
+        return transport->send(to, payload);
+    }
+    auto& outbox = it != outboxes.end() ? it->second : outboxes[to];
+    if(outbox.closing) {
+        outbox.dropped += 1;
+        return true;
+    }
+    if(outbox.bytes + payload.size() > relay_limits.high_watermark) {
+        if(!std::exchange(outbox.over_limit, true)) {
+            log_warn("relay queue of ", to, " exceeded high watermark, ", outbox.bytes, " bytes queued");
+        }
+        switch(relay_limits.policy) {
+        case RelayPolicy::Pause:
+            if(from != nullptr && paused.emplace(from, to).second) {
+                transport->set_receiving(from, false);
+                outbox.paused_senders.push_back(from);
+            }
+            break;
+        case RelayPolicy::Drop:
+            outbox.dropped += 1;
+            return true;
+        case RelayPolicy::Disconnect:
+            log_warn("disconnecting slow receiver ", to);
+            disconnect_receiver(to, outbox);
+            return true;
+        }
+    }
+    outbox.bulk.emplace_back(payload.begin(), payload.end());
+    outbox.bytes += payload.size();
+    metrics::add(metrics::Metric::RelayQueuedBytes, payload.size());
+    return true;
+}
+
+auto Server::flush_outboxes() -> void {
+    // every connection is visited once per loop iteration,
+    // so relayed bandwidth is shared by deficit round robin
+    for(auto it = outboxes.begin(); it != outboxes.end();) {
+        const auto wsi    = it->first;
+        auto&      outbox = it->second;
+
+        while(!outbox.closing && !outbox.control.empty() && !transport->is_choked(wsi)) {
+            if(!transport->send(wsi, outbox.control.front())) {
+                log_warn("failed to send queued packet to ", wsi);
+            }
+            outbox.control_bytes -= outbox.control.front().size();
+            outbox.control.pop_front();
+        }
+        if(!outbox.closing && outbox.control.empty() && !outbox.bulk.empty() && !transport->is_choked(wsi)) {
+            outbox.deficit += flush_quantum;
+            while(!outbox.bulk.empty() && outbox.bulk.front().size() <= outbox.deficit && !transport->is_choked(wsi)) {
+                const auto& packet = outbox.bulk.front();
+                if(!transport->send(wsi, packet)) {
+                    log_warn("failed to send queued packet to ", wsi);
+                }
+                outbox.deficit -= packet.size();
+                outbox.bytes -= packet.size();
+                metrics::add(metrics::Metric::RelayQueuedBytes, -int64_t(packet.size()));
+                outbox.bulk.pop_front();
+            }
+            if(outbox.bulk.empty()) {
+                outbox.deficit = 0;
+            }
+        }
+        if(outbox.over_limit && outbox.bytes <= relay_limits.low_watermark) {
+            log_info("relay queue of ", wsi, " drained below low watermark");
+            outbox.over_limit = false;
+            for(const auto sender : std::exchange(outbox.paused_senders, {})) {
+                transport->set_receiving(sender, true);
+                paused.erase(sender);
+            }
+        }
+        if(outbox.empty() && outbox.paused_senders.empty() && !outbox.closing) {
+            it = outboxes.erase(it);
+            continue;
+        }
+        if(!outbox.empty() && !outbox.closing) {
+            // nothing else may wake the loop when the receiver drains
+            transport->request_writable(wsi);
+        }
+        it = std::next(it);
+    }
+}
+
+auto Server::close_outbox(lws* const wsi) -> void {
+    if(const auto it = outboxes.find(wsi); it != outboxes.end()) {
+        for(const auto sender : it->second.paused_senders) {
+            transport->set_receiving(sender, true);
+            paused.erase(sender);
+        }
+        metrics::add(metrics::Metric::RelayQueuedBytes, -int64_t(it->second.bytes));
+        outboxes.erase(it);
+    }
+    if(const auto it = paused.find(wsi); it != paused.end()) {
+        if(const auto receiver = outboxes.find(it->second); receiver != outboxes.end()) {
+            std::erase(receiver->second.paused_senders, wsi);
+        }
+        paused.erase(it);
+    }
+}
+
+auto Server::get_queue_depth(lws* const wsi) const -> QueueDepth {
+    const auto it = outboxes.find(wsi);
+    if(it == outboxes.end()) {
+        return {};
+    }
+    const auto& outbox = it->second;
+    return {outbox.bytes, outbox.bulk.size(), outbox.control.size(), outbox.dropped};
+}
+
+auto Server::write_trace(const p2p::trace::Timeline& timeline, const std::string_view name) -> void {
+    auto events = std::string();
+    p2p::trace::append_chrome_events(events, timeline, 1, trace_tid += 1, name);
+    std::fwrite(events.data(), 1, events.size(), trace_file.get());
+    std::fflush(trace_file.get());
+}
+
+auto Server::end_iteration(const std::chrono::nanoseconds post_work) -> void {
+    const auto work = std::exchange(frame_work, {}) + post_work;
+    metrics::observe(metrics::Histogram::LoopIteration, work);
+}
+
+auto Server::observe_loop_lag(const std::chrono::nanoseconds delay) -> void {
+    // exponential moving average over probes,
+    // unlike the busy time of handlers this includes socket and tls work and iterations queued behind each other
+    const auto prev = loop_lag;
+    loop_lag        = (loop_lag * 7 + std::chrono::duration_cast<std::chrono::microseconds>(delay)) / 8;
+    metrics::add(metrics::Metric::LoopLag, (loop_lag - prev).count());
+
+    const auto threshold = admission.lag_threshold;
+    if(threshold.count() == 0) {
+        return;
+    }
+    if(!overloaded && loop_lag > threshold) {
+        log_warn("event loop lag ", loop_lag.count(), "us exceeded threshold, shedding new activations and registrations");
+        overloaded = true;
+        metrics::add(metrics::Metric::Overloaded);
+    } else if(overloaded && loop_lag < threshold / 2) {
+        log_info("event loop lag recovered to ", loop_lag.count(), "us, shed ", shed_count, " requests");
+        overloaded = false;
+        shed_count = 0;
+        metrics::add(metrics::Metric::Overloaded, -1);
+    }
+}
+
+auto Server::admit(const uint8_t shed_metric) -> bool {
+    if(!overloaded) {
+        return true;
+    }
+    shed_count += 1;
+    metrics::add(shed_metric);
+    return false;
+}
+
+auto TokenBucket::consume(const uint64_t amount, const uint64_t rate) -> bool {
+    const auto now     = std::chrono::steady_clock::now();
+    const auto cost    = std::chrono::nanoseconds(amount * 1'000'000'000 / rate);
+    auto       current = tat.load(std::memory_order_relaxed);
+    while(true) {
+        const auto base = std::max(current, now);
+        // an amount larger than the burst is admitted into debt when the bucket is full, otherwise it could never pass
+        if(base > now && base + cost - now > std::chrono::seconds(1)) {
+            return false;
+        }
+        if(tat.compare_exchange_weak(current, base + cost, std::memory_order_relaxed)) {
+            return true;
         }
     }
-    activated = true;
+}
+
+auto Server::acquire_user(const std::string_view name) -> User* {
+    auto it = users.find(name);
+    if(it == users.end()) {
+        it              = users.try_emplace(std::string(name)).first; // not movable
+        it->second.name = name;
+    }
+    return &it->second;
+}
+
+auto Server::erase_user_if_idle(User* const user) -> void {
+    if(user->sessions == 0 && user->pads == 0 && user->channels == 0 && user->pending_requests == 0) {
+        // the key must outlive the erased element
+        const auto name = std::move(user->name);
+        users.erase(name);
+    }
+}
+
+auto Server::acquire_quota(User* const user, uint32_t User::*const usage, uint32_t UserLimits::*const limit) -> bool {
+    if(user == nullptr) {
+        return true;
+    }
+    if(limit != nullptr && user_limits.*limit != 0 && user->*usage >= user_limits.*limit) {
+        return false;
+    }
+    user->*usage += 1;
     return true;
 }
 
+auto Server::release_quota(User* const user, uint32_t User::*const usage) -> void {
+    if(user == nullptr) {
+        return;
+    }
+    user->*usage -= 1;
+    erase_user_if_idle(user);
+}
+
+auto Server::consume_relay_quota(User* const user, const size_t bytes) -> bool {
+    return user == nullptr || user_limits.relay_rate == 0 || user->relay.consume(bytes, user_limits.relay_rate);
+}
+
 struct ServerArgs {
     const char* session_key_secret_file = nullptr;
     const char* user_cert_verifier      = nullptr;
     const char* ssl_cert_file           = nullptr;
     const char* ssl_key_file            = nullptr;
     uint16_t    port                    = 0;
+    uint32_t    resume_grace            = 0;
+    uint32_t    link_auth_timeout       = 30;
+    uint32_t    pad_request_timeout     = 30;
+    uint32_t    idle_pad_timeout        = 0;
+    uint16_t    metrics_port            = 0;
+    uint32_t    relay_high_watermark    = 4 * 1024 * 1024;
+    uint32_t    relay_low_watermark     = 1 * 1024 * 1024;
+    uint32_t    control_queue_limit     = 1 * 1024 * 1024;
+    const char* relay_policy            = "pause";
     bool        help                    = false;
+    const char* log_level               = "info";
+    const char* trace_file              = nullptr;
+    const char* capture_file            = nullptr;
+    bool        capture_secrets         = false;
+    const char* loopback_replay_file    = nullptr;
+    uint32_t    loopback_passes         = 1;
+    uint32_t    shed_lag                = 0;
+    uint32_t    max_handshakes          = 0;
+    uint32_t    handshake_timeout       = 10;
+    uint32_t    quota_sessions          = 0;
+    uint32_t    quota_pads              = 0;
+    uint32_t    quota_channels          = 0;
+    uint32_t    quota_requests          = 0;
+    uint32_t    quota_relay_rate        = 0;
+    uint16_t    udp_relay_port          = 0;
     bool        verbose                 = false;
     bool        websocket_verbose       = false;
     bool        websocket_dump_packets  = false;
@@ -60,14 +633,38 @@ struct ServerArgs {
 
 auto ServerArgs::parse(const int argc, const char* const* const argv, std::string_view program_name, uint16_t default_port) -> std::optional<ServerArgs> {
     auto args   = ServerArgs{.port = default_port};
-    auto parser = args::Parser<uint16_t, uint8_t>();
+    auto parser = args::Parser<uint16_t, uint8_t, uint32_t>();
     parser.kwarg(&args.help, {"-h", "--help"}, {.arg_desc = "print this help message", .state = args::State::Initialized, .no_error_check = true});
     parser.kwarg(&args.port, {"-p"}, {"PORT", "port number to use", args::State::DefaultValue});
     parser.kwarg(&args.session_key_secret_file, {"-k", "--key"}, {"FILE", "enable user verification with the secret file", args::State::Initialized});
     parser.kwarg(&args.user_cert_verifier, {"-c", "--cert-verifier"}, {"EXEC", "full-path of executable to verify user certificate", args::State::Initialized});
     parser.kwarg(&args.ssl_cert_file, {"-sc", "--ssl-cert"}, {"FILE", "ssl certificate file", args::State::Initialized});
     parser.kwarg(&args.ssl_key_file, {"-sk", "--ssl-key"}, {"FILE", "ssk private key file", args::State::Initialized});
-    parser.kwarg(&args.verbose, {"-v"}, {.arg_desc = "enable signaling server debug output", .state = args::State::Initialized});
+    parser.kwarg(&args.resume_grace, {"-r", "--resume-grace"}, {"SEC", "keep pads of disconnected sessions resumable for SEC seconds", args::State::DefaultValue});
+    parser.kwarg(&args.link_auth_timeout, {"--link-auth-timeout"}, {"SEC", "deny pad links not answered in SEC seconds (0 to disable)", args::State::DefaultValue});
+    parser.kwarg(&args.pad_request_timeout, {"--pad-request-timeout"}, {"SEC", "fail pad requests not answered in SEC seconds (0 to disable)", args::State::DefaultValue});
+    parser.kwarg(&args.idle_pad_timeout, {"--idle-pad-timeout"}, {"SEC", "remove pads not linked for SEC seconds (0 to disable)", args::State::DefaultValue});
+    parser.kwarg(&args.relay_high_watermark, {"--relay-high"}, {"BYTES", "limit of queued bytes per receiver", args::State::DefaultValue});
+    parser.kwarg(&args.relay_low_watermark, {"--relay-low"}, {"BYTES", "queued bytes to return below after hitting the limit", args::State::DefaultValue});
+    parser.kwarg(&args.control_queue_limit, {"--control-limit"}, {"BYTES", "limit of queued replies per connection, disconnected over it", args::State::DefaultValue});
+    parser.kwarg(&args.relay_policy, {"--relay-policy"}, {"POLICY(pause|drop|disconnect)", "action on slow receivers", args::State::DefaultValue});
+    parser.kwarg(&args.shed_lag, {"--shed-lag"}, {"MS", "reject new activations and registrations while event loop lag exceeds MS (0 to disable)", args::State::DefaultValue});
+    parser.kwarg(&args.max_handshakes, {"--max-handshakes"}, {"N", "close new connections while N sessions are not activated (0 for unlimited)", args::State::DefaultValue});
+    parser.kwarg(&args.handshake_timeout, {"--handshake-timeout"}, {"SEC", "close connections not activated in SEC seconds (0 to disable)", args::State::DefaultValue});
+    parser.kwarg(&args.quota_sessions, {"--quota-sessions"}, {"N", "concurrent sessions per user (0 for unlimited)", args::State::DefaultValue});
+    parser.kwarg(&args.quota_pads, {"--quota-pads"}, {"N", "registered pads per user (0 for unlimited)", args::State::DefaultValue});
+    parser.kwarg(&args.quota_channels, {"--quota-channels"}, {"N", "registered channels per user (0 for unlimited)", args::State::DefaultValue});
+    parser.kwarg(&args.quota_requests, {"--quota-requests"}, {"N", "pending pad requests per user (0 for unlimited)", args::State::DefaultValue});
+    parser.kwarg(&args.quota_relay_rate, {"--quota-relay"}, {"BYTES", "relayed bytes per second per user (0 for unlimited)", args::State::DefaultValue});
+    parser.kwarg(&args.udp_relay_port, {"--udp-relay-port"}, {"PORT", "relay datagrams of linked pads on udp PORT (0 to disable)", args::State::DefaultValue});
+    parser.kwarg(&args.metrics_port, {"--metrics-port"}, {"PORT", "serve prometheus metrics on 127.0.0.1:PORT (0 to disable)", args::State::DefaultValue});
+    parser.kwarg(&args.log_level, {"-l", "--log-level"}, {"LEVEL(debug|info|warn|error)", "signaling server log level", args::State::DefaultValue});
+    parser.kwarg(&args.trace_file, {"--trace"}, {"FILE", "record link setup timelines to FILE in chrome trace event format", args::State::Initialized});
+    parser.kwarg(&args.capture_file, {"--capture"}, {"FILE", "record every received frame to FILE for capture-replay", args::State::Initialized});
+    parser.kwarg(&args.capture_secrets, {"--capture-secrets"}, {.arg_desc = "keep certificates, link secrets and resume tokens in the capture file", .state = args::State::Initialized});
+    parser.kwarg(&args.loopback_replay_file, {"--loopback-replay"}, {"FILE", "feed a capture file to in-process sessions without sockets and exit", args::State::Initialized});
+    parser.kwarg(&args.loopback_passes, {"--loopback-passes"}, {"N", "repeat --loopback-replay N times", args::State::DefaultValue});
+    parser.kwarg(&args.verbose, {"-v"}, {.arg_desc = "enable signaling server debug output, same as --log-level debug", .state = args::State::Initialized});
     parser.kwarg(&args.websocket_verbose, {"-wv"}, {.arg_desc = "enable websocket debug output", .state = args::State::Initialized});
     parser.kwarg(&args.websocket_dump_packets, {"-wd"}, {.arg_desc = "dump every websocket packets", .state = args::State::Initialized});
     parser.kwarg(&args.libws_debug_bitmap, {"-wb"}, {"BITMAP", "libwebsockets debug flag bitmap", args::State::DefaultValue});
@@ -91,29 +688,71 @@ auto run(const int argc, const char* const* const argv,
     if(args.user_cert_verifier != nullptr) {
         server.user_cert_verifier = std::filesystem::absolute(args.user_cert_verifier).string();
     }
-    server.verbose = args.verbose;
+    server.resume_grace        = std::chrono::seconds(args.resume_grace);
+    server.link_auth_timeout   = std::chrono::seconds(args.link_auth_timeout);
+    server.pad_request_timeout = std::chrono::seconds(args.pad_request_timeout);
+    server.idle_pad_timeout    = std::chrono::seconds(args.idle_pad_timeout);
+    unwrap(log_level, logger::parse_level(args.log_level), "invalid log level ", args.log_level);
+    logger::set_level(args.verbose ? logger::Level::Debug : log_level);
+    if(args.trace_file != nullptr) {
+        server.trace_file.reset(std::fopen(args.trace_file, "w"));
+        ensure(server.trace_file, "failed to open trace file");
+        // the closing bracket is optional in the json array format
+        const auto header = "[\n" + p2p::trace::process_name_event(1, protocol);
+        std::fwrite(header.data(), 1, header.size(), server.trace_file.get());
+    }
+    if(args.capture_file != nullptr) {
+        ensure(server.capture.open(args.capture_file, protocol));
+        server.capture_secrets = args.capture_secrets;
+        session_initer.reset(new CapturingInitializer(std::move(session_initer), server.capture));
+    }
 
-    auto& wsctx   = server.websocket_context;
+    server.relay_limits.high_watermark = args.relay_high_watermark;
+    server.relay_limits.low_watermark  = args.relay_low_watermark;
+    server.relay_limits.control_limit  = args.control_queue_limit;
+    ensure(server.relay_limits.low_watermark <= server.relay_limits.high_watermark, "low watermark exceeds high watermark");
+    if(const auto policy = std::string_view(args.relay_policy); policy == "pause") {
+        server.relay_limits.policy = RelayPolicy::Pause;
+    } else if(policy == "drop") {
+        server.relay_limits.policy = RelayPolicy::Drop;
+    } else if(policy == "disconnect") {
+        server.relay_limits.policy = RelayPolicy::Disconnect;
+    } else {
+        bail("invalid relay policy ", policy);
+    }
+
+    server.admission.lag_threshold     = std::chrono::milliseconds(args.shed_lag);
+    server.admission.max_handshakes    = args.max_handshakes;
+    server.admission.handshake_timeout = std::chrono::seconds(args.handshake_timeout);
+    server.user_limits                 = UserLimits{
+                        .sessions         = args.quota_sessions,
+                        .pads             = args.quota_pads,
+                        .channels         = args.quota_channels,
+                        .pending_requests = args.quota_requests,
+                        .relay_rate       = args.quota_relay_rate,
+    };
+    session_initer.reset(new AdmissionInitializer(std::move(session_initer), server));
+    server.udp_relay_port = args.udp_relay_port;
+
+    if(args.metrics_port != 0) {
+        ensure(metrics::start_server(args.metrics_port));
+    }
+    if(args.loopback_replay_file != nullptr) {
+        const auto transport = new LoopbackTransport(server, std::move(session_initer));
+        server.transport.reset(transport);
+        return transport->replay(args.loopback_replay_file, args.loopback_passes);
+    }
+
+    auto& wsctx   = server.websocket_context.emplace();
     wsctx.handler = [&server](lws* wsi, std::span<const std::byte> payload) -> void {
-        auto& session = *std::bit_cast<Session*>(ws::server::wsi_to_userdata(wsi));
-        if(server.verbose) {
-            line_print("session ", &session, ": ", "received ", payload.size(), " bytes");
-        }
-        if(!session.handle_payload(payload)) {
-            line_warn("payload handling failed");
-
-            const auto& header_o = p2p::proto::extract_header(payload);
-            if(!header_o) {
-                line_warn("packet too short");
-                ensure_v(server.send_to(wsi, p2p::proto::Type::Error, 0));
-            } else {
-                ensure_v(server.send_to(wsi, p2p::proto::Type::Error, header_o->id));
-            }
-        }
+        server.handle_frame(wsi, *std::bit_cast<Session*>(ws::server::wsi_to_userdata(wsi)), payload);
     };
     wsctx.session_data_initer = std::move(session_initer);
     wsctx.verbose             = args.websocket_verbose;
     wsctx.dump_packets        = args.websocket_dump_packets;
+
+    const auto transport = new WebSocketTransport(wsctx);
+    server.transport.reset(transport);
     ws::set_log_level(args.libws_debug_bitmap);
     ensure(wsctx.init({
         .protocol    = protocol,
@@ -121,9 +760,24 @@ auto run(const int argc, const char* const* const argv,
         .private_key = args.ssl_key_file,
         .port        = args.port,
     }));
-    print("ready");
+    log_info("ready");
+    auto lag_probe = std::chrono::steady_clock::now() + lag_probe_interval;
     while(wsctx.state == ws::server::State::Connected) {
         wsctx.process();
+        const auto start = std::chrono::steady_clock::now();
+        if(start >= lag_probe) {
+            server.observe_loop_lag(start - lag_probe);
+            lag_probe = start + lag_probe_interval;
+        }
+        server.timers.advance();
+        server.flush_outboxes();
+        server.capture.flush();
+        const auto next = server.timers.next_expiry();
+        server.transport->wake_at(next ? std::min(*next, lag_probe) : lag_probe);
+        server.end_iteration(std::chrono::steady_clock::now() - start);
     }
+    // free the sessions while the timers, quotas, outboxes and pads they release into still exist
+    transport->detach();
+    server.websocket_context.reset();
     return true;
 }
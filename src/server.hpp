@@ -1,26 +1,215 @@
 #pragma once
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include "capture.hpp"
+#include "fragment.hpp"
+#include "macros/autoptr.hpp"
 #include "protocol-helper.hpp"
 #include "session-key.hpp"
+#include "timer-wheel.hpp"
+#include "trace.hpp"
+#include "util/string-map.hpp"
 #include "ws/server.hpp"
 
+declare_autoptr(File, FILE, fclose);
+
+struct RelayPolicy {
+    enum : uint8_t {
+        Pause,      // stop reading from the sender until the queue drains
+        Drop,       // discard packets exceeding the limit
+        Disconnect, // close the slow receiver
+
+        Limit,
+    };
+};
+
+struct RelayLimits {
+    size_t  high_watermark = 4 * 1024 * 1024;
+    size_t  low_watermark  = 1 * 1024 * 1024;
+    uint8_t policy         = RelayPolicy::Pause;
+    size_t  control_limit  = 1 * 1024 * 1024; // queued bytes of server generated packets, the receiver is disconnected over it
+};
+
+struct AdmissionLimits {
+    std::chrono::microseconds lag_threshold     = {}; // shed new activations and registrations above this, 0 to disable
+    uint32_t                  max_handshakes    = 0;  // connections not activated yet, 0 for unlimited
+    std::chrono::seconds      handshake_timeout = {}; // close connections not activated in time, 0 to disable
+};
+
+// per user, 0 for unlimited
+struct UserLimits {
+    uint32_t sessions         = 0;
+    uint32_t pads             = 0;
+    uint32_t channels         = 0;
+    uint32_t pending_requests = 0;
+    uint64_t relay_rate       = 0; // bytes per second, bursts up to one second
+};
+
+// token bucket in the virtual scheduling form, holding one second of tokens
+// an amount over one second is admitted when the bucket is full and repaid before anything else passes
+// shared by the server thread and the udp relay thread
+struct TokenBucket {
+    std::atomic<std::chrono::steady_clock::time_point> tat = {}; // theoretical arrival time of the next byte
+
+    auto consume(uint64_t amount, uint64_t rate) -> bool;
+};
+
+// resource usage of a user identified by the certificate
+struct User {
+    std::string name;
+    uint32_t    sessions         = 0;
+    uint32_t    pads             = 0;
+    uint32_t    channels         = 0;
+    uint32_t    pending_requests = 0;
+    TokenBucket relay;
+};
+
+struct QueueDepth {
+    size_t   bytes           = 0; // relayed
+    size_t   packets         = 0; // relayed
+    size_t   control_packets = 0;
+    uint64_t dropped         = 0;
+};
+
+// packets waiting for a slow connection
+struct Outbox {
+    std::deque<std::vector<std::byte>> control; // server generated packets, served first
+    std::deque<std::vector<std::byte>> bulk;    // relayed packets
+    size_t                             bytes         = 0; // of bulk
+    size_t                             control_bytes = 0; // of control
+    size_t                             deficit       = 0; // deficit round robin counter of bulk
+    uint64_t                           dropped = 0;
+    std::vector<lws*>                  paused_senders;
+    bool                               over_limit = false;
+    bool                               closing    = false;
+
+    auto empty() const -> bool {
+        return control.empty() && bulk.empty();
+    }
+};
+
+// connection backend of the server
+// lws* is an opaque connection handle outside of the implementation
+struct Transport {
+    virtual auto send(lws* wsi, std::span<const std::byte> payload) -> bool = 0;
+    // true if the connection can not take more data now
+    virtual auto is_choked(lws* wsi) -> bool = 0;
+    // pause or resume receiving from the connection
+    virtual auto set_receiving(lws* wsi, bool enable) -> void = 0;
+    // make the event loop return once the connection can take more data
+    virtual auto request_writable(lws* wsi) -> void = 0;
+    // close the connection asynchronously
+    virtual auto close(lws* wsi) -> void = 0;
+    // called for each new connection before its session is used
+    virtual auto on_open(lws* /*wsi*/) -> void {}
+    // make the event loop return by time even without any events
+    virtual auto wake_at(std::chrono::steady_clock::time_point /*time*/) -> void {}
+
+    virtual ~Transport() {}
+};
+
+struct Session;
+
 struct Server {
-    ws::server::Context       websocket_context;
-    std::optional<SessionKey> session_key;
-    std::string               user_cert_verifier;
-    bool                      verbose = false;
+    p2p::proto::BufferPool             reassembly_pool; // outlives the sessions of websocket_context
+    // destroying it frees the sessions, which release into the other members and those of derived servers
+    // so run destroys it while they all exist
+    std::optional<ws::server::Context> websocket_context;
+    std::unique_ptr<Transport>         transport;
+    TimerWheel                         timers;
+    std::optional<SessionKey>          session_key;
+    std::string                        user_cert_verifier;
+    std::chrono::seconds               resume_grace        = {};
+    std::chrono::seconds               link_auth_timeout   = {};
+    std::chrono::seconds               pad_request_timeout = {};
+    std::chrono::seconds               idle_pad_timeout    = {};
+    RelayLimits                        relay_limits;
+    AutoFile                           trace_file; // link setup timelines, chrome trace event format
+    int                                trace_tid = 0;
+    capture::Writer                    capture;                 // received frames, for replaying
+    bool                               capture_secrets = false; // credentials are zeroed in captures unless set
+    AdmissionLimits                    admission;
+    uint32_t                           handshaking = 0;
+    std::chrono::microseconds          loop_lag    = {}; // smoothed delay of wakeups scheduled by the loop
+    std::chrono::nanoseconds           frame_work  = {}; // spent in handle_frame in this iteration
+    bool                               overloaded  = false;
+    uint64_t                           shed_count  = 0; // since overloaded
+    UserLimits                         user_limits;
+    StringMap<User>                    users;              // only users with any resource
+    uint16_t                           udp_relay_port = 0; // 0 to disable
+
+    std::unordered_map<lws*, Outbox> outboxes; // only connections with queued packets or paused senders
+    std::unordered_map<lws*, lws*>   paused;   // sender -> receiver
+
+    // dispatch a received frame to the session of the connection
+    auto handle_frame(lws* wsi, Session& session, std::span<const std::byte> payload) -> void;
+    auto handle_packet(lws* wsi, Session& session, std::span<const std::byte> payload) -> void;
+    auto handle_fragment(lws* wsi, Session& session, std::span<const std::byte> payload) -> bool;
+    // with the credentials found by the session zeroed unless capture_secrets
+    auto capture_frame(const Session& session, std::span<const std::byte> payload) -> void;
+    // packets larger than max_packet_size are sent as fragments
+    auto send(lws* wsi, std::span<const std::byte> payload) -> bool;
+    // like send, but queued behind relayed packets instead of overtaking them, for link state changes
+    auto send_ordered(lws* wsi, std::span<const std::byte> payload) -> bool;
+    // send with the relay limits applied, from is nullptr for packets kept by the server
+    auto relay(lws* from, lws* to, std::span<const std::byte> payload) -> bool;
+    // queue a server generated packet, disconnecting a receiver that does not read its replies
+    auto queue_control(lws* wsi, Outbox& outbox, std::span<const std::byte> payload) -> bool;
+    auto disconnect_receiver(lws* wsi, Outbox& outbox) -> void;
+    auto flush_outboxes() -> void;
+    // must be called when the connection is closed
+    auto close_outbox(lws* wsi) -> void;
+    auto get_queue_depth(lws* wsi) const -> QueueDepth;
+    auto write_trace(const p2p::trace::Timeline& timeline, std::string_view name) -> void;
+    // record the busy time of an iteration, post_work: time spent after polling
+    auto end_iteration(std::chrono::nanoseconds post_work) -> void;
+    // update loop lag and overload state, delay: how late a wakeup scheduled by the loop ran
+    auto observe_loop_lag(std::chrono::nanoseconds delay) -> void;
+    // false while overloaded, counting the rejection to shed_metric
+    auto admit(uint8_t shed_metric) -> bool;
+    // quotas, nullptr user is unrestricted
+    auto acquire_user(std::string_view name) -> User*;
+    auto erase_user_if_idle(User* user) -> void;
+    // limit may be nullptr to skip the check
+    auto acquire_quota(User* user, uint32_t User::*usage, uint32_t UserLimits::*limit) -> bool;
+    // erases the user when nothing is left
+    auto release_quota(User* user, uint32_t User::*usage) -> void;
+    auto consume_relay_quota(User* user, size_t bytes) -> bool;
 
     template <class... Args>
     auto send_to(lws* const wsi, const uint16_t type, const uint32_t id, Args... args) -> bool {
-        return websocket_context.send(wsi, p2p::proto::build_packet(type, id, args...));
+        return send(wsi, p2p::proto::build_packet(type, id, args...));
     }
 };
 
 struct Session {
-    bool activated = false;
+    bool                                   activated  = false;
+    User*                                  user       = nullptr; // nullptr without verified identity
+    uint16_t                               error_code = 0;       // sent with the Error packet when handle_payload fails
+    p2p::proto::Reassembler                reassembler;
+    std::vector<uint32_t>                  relayed_fragments; // ids of packets forwarded as they arrive, oldest first
+    Timer                                  handshake_timer;   // armed until activated
 
     virtual auto handle_payload(std::span<const std::byte> payload) -> bool = 0;
+    // packets of relayed types are forwarded fragment by fragment with relay_fragment instead of being reassembled
+    virtual auto is_relayed(uint16_t /*type*/) const -> bool {
+        return false;
+    }
+    virtual auto relay_fragment(std::span<const std::byte> /*fragment*/) -> bool {
+        return false;
+    }
+    // bytes of a received packet carrying credentials, an empty span if none
+    virtual auto find_secret(std::span<const std::byte> payload) const -> std::span<const std::byte>;
 
     auto activate(Server& server, std::string_view cert) -> bool;
+    // for activations without certificates, e.g. session resumption
+    auto set_activated(Server& server) -> void;
 
     virtual ~Session() {}
 };
@@ -1,3 +1,7 @@
+#include <fstream>
+#include <iostream>
+#include <thread>
+
 #include "macros/unwrap.hpp"
 #include "session-key.hpp"
 #include "util/argument-parser.hpp"
@@ -22,15 +26,236 @@ auto verify_cert(const char* const secret_file, const char* const content_file)
     const auto [hash_str, content] = parsed;
     return key.verify_user_certificate_hash(hash_str, content);
 }
+
+// batch mode
+// plain manifest:
+//   sign:   CONTENT                 -> HASH
+//   verify: HASH CONTENT            -> ok|fail
+// jsonl manifest, every line is a json string:
+//   sign:   "CONTENT"               -> "CERTIFICATE"
+//   verify: "CERTIFICATE"           -> true|false
+// unparsable lines result in "error" or null
+constexpr auto batch_lines = size_t(16384);
+
+auto append_utf8(std::string& str, const uint32_t cp) -> void {
+    if(cp < 0x80) {
+        str += char(cp);
+    } else if(cp < 0x800) {
+        str += char(0xc0 | cp >> 6);
+        str += char(0x80 | (cp & 0x3f));
+    } else if(cp < 0x10000) {
+        str += char(0xe0 | cp >> 12);
+        str += char(0x80 | (cp >> 6 & 0x3f));
+        str += char(0x80 | (cp & 0x3f));
+    } else {
+        str += char(0xf0 | cp >> 18);
+        str += char(0x80 | (cp >> 12 & 0x3f));
+        str += char(0x80 | (cp >> 6 & 0x3f));
+        str += char(0x80 | (cp & 0x3f));
+    }
+}
+
+auto parse_hex4(const std::string_view str, size_t& i) -> std::optional<uint32_t> {
+    ensure(i + 4 <= str.size());
+    auto value = uint32_t(0);
+    for(const auto c : str.substr(i, 4)) {
+        value <<= 4;
+        if(c >= '0' && c <= '9') {
+            value |= c - '0';
+        } else if(c >= 'a' && c <= 'f') {
+            value |= c - 'a' + 10;
+        } else if(c >= 'A' && c <= 'F') {
+            value |= c - 'A' + 10;
+        } else {
+            return std::nullopt;
+        }
+    }
+    i += 4;
+    return value;
+}
+
+auto parse_json_string(std::string_view str) -> std::optional<std::string> {
+    while(!str.empty() && (str.back() == ' ' || str.back() == '\r' || str.back() == '\t')) {
+        str.remove_suffix(1);
+    }
+    while(!str.empty() && (str.front() == ' ' || str.front() == '\t')) {
+        str.remove_prefix(1);
+    }
+    ensure(str.size() >= 2 && str.front() == '"' && str.back() == '"');
+    str = str.substr(1, str.size() - 2);
+
+    auto ret = std::string();
+    for(auto i = size_t(0); i < str.size();) {
+        const auto c = str[i];
+        i += 1;
+        if(c != '\\') {
+            ensure(c != '"' && uint8_t(c) >= 0x20);
+            ret += c;
+            continue;
+        }
+        ensure(i < str.size());
+        const auto e = str[i];
+        i += 1;
+        switch(e) {
+        case '"':
+        case '\\':
+        case '/':
+            ret += e;
+            break;
+        case 'b':
+            ret += '\b';
+            break;
+        case 'f':
+            ret += '\f';
+            break;
+        case 'n':
+            ret += '\n';
+            break;
+        case 'r':
+            ret += '\r';
+            break;
+        case 't':
+            ret += '\t';
+            break;
+        case 'u': {
+            unwrap(cp, parse_hex4(str, i));
+            if(cp >= 0xd800 && cp < 0xdc00) {
+                ensure(str.substr(i).starts_with("\\u"));
+                i += 2;
+                unwrap(low, parse_hex4(str, i));
+                ensure(low >= 0xdc00 && low < 0xe000);
+                append_utf8(ret, 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00));
+            } else {
+                append_utf8(ret, cp);
+            }
+        } break;
+        default:
+            bail("invalid escape sequence");
+        }
+    }
+    return ret;
+}
+
+auto to_json_string(const std::string_view str) -> std::string {
+    auto ret = std::string("\"");
+    for(const auto c : str) {
+        switch(c) {
+        case '"':
+            ret += "\\\"";
+            break;
+        case '\\':
+            ret += "\\\\";
+            break;
+        case '\n':
+            ret += "\\n";
+            break;
+        case '\r':
+            ret += "\\r";
+            break;
+        case '\t':
+            ret += "\\t";
+            break;
+        default:
+            if(uint8_t(c) < 0x20) {
+                constexpr auto hex = "0123456789abcdef";
+                ret += "\\u00";
+                ret += hex[c >> 4];
+                ret += hex[c & 0x0f];
+            } else {
+                ret += c;
+            }
+        }
+    }
+    ret += '"';
+    return ret;
+}
+
+auto process_line(SessionKey& key, const std::string_view line, const bool verify, const bool jsonl) -> std::optional<std::string> {
+    if(!jsonl) {
+        if(!verify) {
+            unwrap(cert, key.generate_user_certificate(line));
+            return cert.substr(0, cert.find('\n'));
+        }
+        const auto sep = line.find(' ');
+        ensure(sep != line.npos);
+        return key.verify_user_certificate_hash(line.substr(0, sep), line.substr(sep + 1)) ? "ok" : "fail";
+    }
+    unwrap(str, parse_json_string(line));
+    if(!verify) {
+        unwrap(cert, key.generate_user_certificate(str));
+        return to_json_string(cert);
+    }
+    unwrap(parsed, SessionKey::split_user_certificate_to_hash_and_content(str));
+    const auto [hash_str, content] = parsed;
+    return key.verify_user_certificate_hash(hash_str, content) ? "true" : "false";
+}
+
+auto run_batch(const char* const secret_file, const char* const manifest, const bool verify, const bool jsonl, uint32_t jobs) -> bool {
+    unwrap(secret, read_file(secret_file));
+    auto key = SessionKey(secret);
+
+    auto file = std::ifstream();
+    if(std::string_view(manifest) != "-") {
+        file.open(manifest);
+        ensure(file, "failed to open manifest");
+    }
+    auto& input = file.is_open() ? file : std::cin;
+    if(jobs == 0) {
+        jobs = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    auto lines   = std::vector<std::string>();
+    auto results = std::vector<std::string>();
+    auto failed  = false;
+    while(true) {
+        lines.clear();
+        for(auto line = std::string(); lines.size() < batch_lines && std::getline(input, line);) {
+            lines.push_back(std::move(line));
+        }
+        if(lines.empty()) {
+            break;
+        }
+
+        results.resize(lines.size());
+        auto workers = std::vector<std::thread>();
+        for(auto j = 0u; j < jobs; j += 1) {
+            workers.emplace_back([&, j]() {
+                for(auto i = size_t(j); i < lines.size(); i += jobs) {
+                    const auto result = process_line(key, lines[i], verify, jsonl);
+                    results[i]        = result ? *result : jsonl ? "null" : "error";
+                }
+            });
+        }
+        for(auto& worker : workers) {
+            worker.join();
+        }
+
+        auto output = std::string();
+        for(const auto& result : results) {
+            failed |= result == "error" || result == "null";
+            output += result;
+            output += '\n';
+        }
+        std::fwrite(output.data(), 1, output.size(), stdout);
+    }
+    std::fflush(stdout);
+    return !failed;
+}
 } // namespace
 
 auto main(const int argc, const char* const* const argv) -> int {
     auto secret = (const char*)(nullptr);
     auto file   = (const char*)(nullptr);
     auto verify = false;
+    auto batch  = false;
+    auto jsonl  = false;
+    auto jobs   = uint32_t(0);
     auto help   = false;
-    auto parser = args::Parser();
+    auto parser = args::Parser<uint32_t>();
     parser.kwarg(&verify, {"-d", "--verify"}, {"", "verify user certificate", args::State::Initialized});
+    parser.kwarg(&batch, {"-b", "--batch"}, {"", "TARGET_FILE is a manifest with one entry per line, - for stdin", args::State::Initialized});
+    parser.kwarg(&jsonl, {"--jsonl"}, {"", "manifest entries and results are json strings", args::State::Initialized});
+    parser.kwarg(&jobs, {"-j", "--jobs"}, {"N", "worker threads in batch mode (default: all cores)", args::State::Initialized});
     parser.kwarg(&help, {"-h", "--help"}, {.arg_desc = "print this help message", .state = args::State::Initialized, .no_error_check = true});
     parser.arg(&secret, {"SECRET_FILE"});
     parser.arg(&file, {"TARGET_FILE"});
@@ -39,7 +264,9 @@ auto main(const int argc, const char* const* const argv) -> int {
         return 1;
     }
 
-    if(!verify) {
+    if(batch) {
+        return run_batch(secret, file, verify, jsonl, jobs) ? 0 : 1;
+    } else if(!verify) {
         return generate_cert(secret, file) ? 0 : 1;
     } else {
         print(verify_cert(secret, file) ? "ok" : "fail");
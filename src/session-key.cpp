@@ -1,34 +1,130 @@
 #include <cstring>
 
+#include <openssl/crypto.h>
+
 #include "crypto/base64.hpp"
-#include "crypto/hmac.hpp"
 #include "macros/unwrap.hpp"
 #include "util/span.hpp"
 
 #include "session-key.hpp"
 
+// certificates come from the network, servers report invalid ones through the logger instead of blocking on stderr
+#if defined(P2P_SERVER)
+#include "logger.hpp"
+#define input_ensure log_ensure
+#else
+#define input_ensure ensure
+#endif
+
+namespace {
+constexpr auto sha256_block_size = size_t(64);
+
+// decodes exactly one hmac-sha256 hash, 43 characters and one padding
+constexpr auto encoded_hash_size = size_t(44);
+
+constexpr auto invalid_char = uint8_t(0x80);
+
+constexpr auto base64_table = [] {
+    auto table = std::array<uint8_t, 256>();
+    table.fill(invalid_char);
+    constexpr auto chars = std::string_view("ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/");
+    for(auto i = size_t(0); i < chars.size(); i += 1) {
+        table[uint8_t(chars[i])] = i;
+    }
+    return table;
+}();
+
+// branchless, invalid characters are accumulated and checked once at the end
+auto decode_hash(const std::string_view str, SessionKey::Hash& hash) -> bool {
+    input_ensure(str.size() == encoded_hash_size && str[43] == '=', "not a valid certification hash");
+
+    auto buffer = std::array<uint8_t, 33>();
+    auto error  = uint8_t(0);
+    for(auto i = size_t(0), o = size_t(0); i < encoded_hash_size; i += 4, o += 3) {
+        const auto a = base64_table[uint8_t(str[i + 0])];
+        const auto b = base64_table[uint8_t(str[i + 1])];
+        const auto c = base64_table[uint8_t(str[i + 2])];
+        const auto d = i + 4 == encoded_hash_size ? uint8_t(0) : base64_table[uint8_t(str[i + 3])];
+        error |= a | b | c | d;
+
+        const auto word = uint32_t(a) << 18 | uint32_t(b) << 12 | uint32_t(c) << 6 | d;
+        buffer[o + 0]   = word >> 16;
+        buffer[o + 1]   = word >> 8;
+        buffer[o + 2]   = word;
+    }
+    input_ensure((error & invalid_char) == 0, "not a base64 encoded string");
+    std::memcpy(hash.data(), buffer.data(), hash.size());
+    return true;
+}
+
+auto init_padded_state(const std::array<std::byte, sha256_block_size>& key, const uint8_t pad) -> EVP_MD_CTX* {
+    auto block = key;
+    for(auto& b : block) {
+        b ^= std::byte(pad);
+    }
+    auto ctx = AutoMDContext(EVP_MD_CTX_new());
+    ensure(ctx);
+    ensure(EVP_DigestInit_ex(ctx.get(), EVP_sha256(), nullptr) == 1);
+    ensure(EVP_DigestUpdate(ctx.get(), block.data(), block.size()) == 1);
+    OPENSSL_cleanse(block.data(), block.size());
+    return ctx.release();
+}
+} // namespace
+
+auto SessionKey::compute_hash(const std::string_view content) const -> std::optional<Hash> {
+    ensure(inner && outer, "session key not initialized");
+
+    // reused per thread to avoid allocations
+    thread_local auto scratch = AutoMDContext(EVP_MD_CTX_new());
+    ensure(scratch);
+
+    auto inner_hash = Hash();
+    auto hash       = Hash();
+    ensure(EVP_MD_CTX_copy_ex(scratch.get(), inner.get()) == 1);
+    ensure(EVP_DigestUpdate(scratch.get(), content.data(), content.size()) == 1);
+    ensure(EVP_DigestFinal_ex(scratch.get(), std::bit_cast<unsigned char*>(inner_hash.data()), nullptr) == 1);
+    ensure(EVP_MD_CTX_copy_ex(scratch.get(), outer.get()) == 1);
+    ensure(EVP_DigestUpdate(scratch.get(), inner_hash.data(), inner_hash.size()) == 1);
+    ensure(EVP_DigestFinal_ex(scratch.get(), std::bit_cast<unsigned char*>(hash.data()), nullptr) == 1);
+    return hash;
+}
+
 auto SessionKey::split_user_certificate_to_hash_and_content(const std::string_view cert) -> std::optional<std::array<std::string_view, 2>> {
     const auto lf = cert.find('\n');
-    ensure(lf != cert.npos);
+    input_ensure(lf != cert.npos);
     const auto hash_str = cert.substr(0, lf);
     const auto content  = cert.substr(lf + 1);
     return std::array{hash_str, content};
 }
 
 auto SessionKey::generate_user_certificate(const std::string_view content) -> std::optional<std::string> {
-    unwrap(hash, crypto::hmac::compute_hmac_sha256(secret, to_span(content)));
+    unwrap(hash, compute_hash(content));
     const auto hash_str = crypto::base64::encode(hash);
     return build_string(hash_str, "\n", content);
 }
 
 auto SessionKey::verify_user_certificate_hash(const std::string_view hash_str, const std::string_view content) -> bool {
-    ensure(hash_str.size() % 4 == 0, "not a base64 encoded string");
-    const auto hash = crypto::base64::decode(hash_str);
-    unwrap(computed_hash, crypto::hmac::compute_hmac_sha256(secret, to_span(content)));
-    ensure(hash.size() == computed_hash.size(), "not a valid certification hash");
-    ensure(std::memcmp(hash.data(), computed_hash.data(), hash.size()) == 0, "hash mismatched");
+    auto hash = Hash();
+    input_ensure(decode_hash(hash_str, hash));
+    unwrap(computed_hash, compute_hash(content));
+    input_ensure(CRYPTO_memcmp(hash.data(), computed_hash.data(), hash.size()) == 0, "hash mismatched");
     return true;
 }
 
-SessionKey::SessionKey(std::vector<std::byte> secret)
-    : secret(secret) {}
+SessionKey::SessionKey(std::vector<std::byte> secret) {
+    // keys longer than a block are hashed first
+    auto key = std::array<std::byte, sha256_block_size>();
+    if(secret.size() > key.size()) {
+        auto size = 0u;
+        if(EVP_Digest(secret.data(), secret.size(), std::bit_cast<unsigned char*>(key.data()), &size, EVP_sha256(), nullptr) != 1) {
+            line_warn("failed to hash session key");
+            return;
+        }
+    } else {
+        std::memcpy(key.data(), secret.data(), secret.size());
+    }
+    inner.reset(init_padded_state(key, 0x36));
+    outer.reset(init_padded_state(key, 0x5c));
+    OPENSSL_cleanse(key.data(), key.size());
+    OPENSSL_cleanse(secret.data(), secret.size());
+}
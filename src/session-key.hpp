@@ -4,14 +4,28 @@
 #include <string_view>
 #include <vector>
 
+#include <openssl/evp.h>
+
+#include "macros/autoptr.hpp"
+
+declare_autoptr(MDContext, EVP_MD_CTX, EVP_MD_CTX_free);
+
 class SessionKey {
+  public:
+    using Hash = std::array<std::byte, 32>; // hmac-sha256
+
   private:
-    std::vector<std::byte> secret;
+    // sha256 states after absorbing the padded key, so that each hmac costs only the content
+    AutoMDContext inner; // key ^ ipad
+    AutoMDContext outer; // key ^ opad
+
+    auto compute_hash(std::string_view content) const -> std::optional<Hash>;
 
   public:
     static auto split_user_certificate_to_hash_and_content(std::string_view cert) -> std::optional<std::array<std::string_view, 2>>;
 
     auto generate_user_certificate(std::string_view content) -> std::optional<std::string>;
+    // safe to call from multiple threads
     auto verify_user_certificate_hash(std::string_view hash_str, std::string_view content) -> bool;
 
     SessionKey(std::vector<std::byte> secret);
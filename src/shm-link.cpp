@@ -0,0 +1,225 @@
+#include <cstring>
+#include <fstream>
+#include <random>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "shm-link.hpp"
+#include "macros/unwrap.hpp"
+
+namespace p2p::ice {
+namespace {
+constexpr auto magic        = uint64_t(0x6b6e696c6d687370); // "pshmlink"
+constexpr auto pad_record   = uint32_t(-1);
+constexpr auto record_align = size_t(8);
+
+auto align_record(const size_t size) -> size_t {
+    return (sizeof(uint32_t) + size + record_align - 1) / record_align * record_align;
+}
+
+// shared, not private, futex operations as the word is mapped in two processes
+auto futex_wait(std::atomic<uint32_t>& word, const uint32_t value) -> void {
+    syscall(SYS_futex, &word, FUTEX_WAIT, value, nullptr, nullptr, 0);
+}
+
+auto futex_wake(std::atomic<uint32_t>& word) -> void {
+    syscall(SYS_futex, &word, FUTEX_WAKE, 1, nullptr, nullptr, 0);
+}
+} // namespace
+
+struct ShmLink::Ring {
+    alignas(64) std::atomic<uint64_t> head; // bytes written, by the producer
+    alignas(64) std::atomic<uint64_t> tail; // bytes read, by the consumer
+    alignas(64) std::atomic<uint32_t> waiting;
+    std::atomic<uint32_t> signal; // futex word, bumped to wake the consumer
+};
+
+struct ShmLink::Segment {
+    uint64_t magic;
+    uint64_t capacity;
+    Ring     rings[2];
+    // std::byte data[2][capacity];
+};
+
+auto read_host_id() -> std::optional<std::string> {
+    auto file = std::ifstream("/proc/sys/kernel/random/boot_id");
+    auto id   = std::string();
+    ensure(file && std::getline(file, id) && !id.empty(), "failed to read boot id");
+    return id;
+}
+
+auto ShmLink::map(const int fd, const size_t size) -> bool {
+    const auto ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    ensure(ptr != MAP_FAILED, "mmap failed: ", strerror(errno));
+    segment = std::bit_cast<Segment*>(ptr);
+    mapped  = size;
+    return true;
+}
+
+auto ShmLink::create(const size_t capacity) -> bool {
+    ensure(capacity % record_align == 0, "capacity must be a multiple of ", record_align);
+    auto random = std::random_device();
+    for(auto i = 0; i < 8; i += 1) {
+        name = "/p2p-shm-" + std::to_string(random()) + std::to_string(random());
+        if(const auto fd = shm_open(name.data(), O_RDWR | O_CREAT | O_EXCL, 0600); fd >= 0) {
+            creator = true;
+            ensure(ftruncate(fd, sizeof(Segment) + capacity * 2) == 0, "ftruncate failed: ", strerror(errno));
+            ensure(map(fd, sizeof(Segment) + capacity * 2));
+            // a fresh segment is zero filled
+            segment->magic    = magic;
+            segment->capacity = capacity;
+            this->capacity    = capacity;
+            tx                = &segment->rings[0];
+            rx                = &segment->rings[1];
+            tx_data           = std::bit_cast<std::byte*>(segment + 1);
+            rx_data           = tx_data + capacity;
+            return true;
+        }
+        ensure(errno == EEXIST, "shm_open failed: ", strerror(errno));
+    }
+    bail("failed to find a free shared memory name");
+}
+
+auto ShmLink::open(const std::string_view name) -> bool {
+    this->name    = name;
+    const auto fd = shm_open(this->name.data(), O_RDWR, 0);
+    ensure(fd >= 0, "shm_open failed: ", strerror(errno));
+    struct stat st = {};
+    if(fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(Segment)) {
+        close(fd);
+        bail("shared memory segment too small");
+    }
+    ensure(map(fd, st.st_size));
+    capacity = segment->capacity;
+    ensure(segment->magic == magic && capacity != 0 && capacity % record_align == 0 && sizeof(Segment) + capacity * 2 == mapped,
+           "invalid shared memory segment");
+    tx      = &segment->rings[1];
+    rx      = &segment->rings[0];
+    rx_data = std::bit_cast<std::byte*>(segment + 1);
+    tx_data = rx_data + capacity;
+    return true;
+}
+
+auto ShmLink::unlink() -> void {
+    if(creator) {
+        shm_unlink(name.data());
+        creator = false;
+    }
+}
+
+auto ShmLink::get_name() const -> const std::string& {
+    return name;
+}
+
+auto ShmLink::reader_main(const OnDatagram on_datagram, const OnBroken on_broken) -> void {
+    // the peer can write anything to the segment, a bad head or record must not move reads out of the ring
+    const auto corrupted = [this, &on_broken](const char* const what) {
+        line_warn("shared memory ring corrupted: ", what, ", closing the link");
+        broken = true;
+        on_broken();
+    };
+    auto tail = rx->tail.load();
+    if(tail % record_align != 0) {
+        corrupted("misaligned tail");
+        return;
+    }
+    while(!stopping) {
+        const auto signal = rx->signal.load();
+        const auto head   = rx->head.load(std::memory_order_acquire);
+        if(head - tail > capacity || head % record_align != 0) {
+            corrupted("bad head");
+            return;
+        }
+        if(tail == head) {
+            // the producer checks waiting after publishing head, so one of us sees the other
+            rx->waiting.store(1);
+            if(rx->head.load() == tail && !stopping) {
+                futex_wait(rx->signal, signal);
+            }
+            rx->waiting.store(0);
+            continue;
+        }
+        while(tail != head) {
+            const auto offset = tail % capacity;
+            auto       size   = uint32_t();
+            std::memcpy(&size, rx_data + offset, sizeof(size));
+            // a record, padding included, ends at or before the end of the ring and within what was written
+            const auto need = size == pad_record ? capacity - offset : align_record(size);
+            if(need > capacity - offset || need > head - tail) {
+                corrupted("bad record size");
+                return;
+            }
+            if(size != pad_record) {
+                on_datagram(std::span(rx_data + offset + sizeof(size), size));
+            }
+            tail += need;
+            rx->tail.store(tail, std::memory_order_release);
+        }
+    }
+}
+
+auto ShmLink::start(OnDatagram on_datagram, OnBroken on_broken) -> void {
+    reader = std::thread(&ShmLink::reader_main, this, std::move(on_datagram), std::move(on_broken));
+}
+
+auto ShmLink::stop() -> void {
+    stopping = true;
+    if(reader.joinable()) {
+        rx->signal.fetch_add(1);
+        futex_wake(rx->signal);
+        reader.join();
+    }
+}
+
+auto ShmLink::is_broken() const -> bool {
+    return broken;
+}
+
+auto ShmLink::send(const std::span<const std::byte> datagram) -> bool {
+    const auto need = align_record(datagram.size());
+    if(broken || need > capacity / 2) {
+        return false;
+    }
+
+    auto       guard  = std::lock_guard(send_lock);
+    auto       head   = tx->head.load(std::memory_order_relaxed);
+    const auto tail   = tx->tail.load(std::memory_order_acquire);
+    const auto offset = head % capacity;
+    // head is only written by us, but lives in memory the peer can write
+    if(head % record_align != 0) {
+        return false;
+    }
+    // records are contiguous, the rest of the ring is skipped if one does not fit before the end
+    const auto skip = capacity - offset < need ? capacity - offset : 0;
+    if(head + skip + need - tail > capacity) {
+        return false;
+    }
+    if(skip != 0) {
+        std::memcpy(tx_data + offset, &pad_record, sizeof(pad_record));
+        head += skip;
+    }
+    const auto size = uint32_t(datagram.size());
+    std::memcpy(tx_data + head % capacity, &size, sizeof(size));
+    std::memcpy(tx_data + head % capacity + sizeof(size), datagram.data(), datagram.size());
+    tx->head.store(head + need);
+    if(tx->waiting.load()) {
+        tx->signal.fetch_add(1);
+        futex_wake(tx->signal);
+    }
+    return true;
+}
+
+ShmLink::~ShmLink() {
+    if(segment != nullptr) {
+        stop();
+        munmap(segment, mapped);
+    }
+    unlink();
+}
+} // namespace p2p::ice
@@ -0,0 +1,60 @@
+#pragma once
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <thread>
+
+namespace p2p::ice {
+// identifies the running kernel, peers with the same id can share memory and futexes
+auto read_host_id() -> std::optional<std::string>;
+
+// pair of single producer single consumer rings in a posix shared memory segment
+// the creator sends on the first ring and the opener on the second
+// each record is [uint32 size][datagram] padded to 8 bytes, a reader sleeping on an empty ring is woken by a futex in the segment
+class ShmLink {
+  public:
+    using OnDatagram = std::function<void(std::span<const std::byte> datagram)>;
+    using OnBroken   = std::function<void()>;
+
+  private:
+    struct Ring;
+    struct Segment;
+
+    std::string       name;
+    Segment*          segment = nullptr;
+    size_t            mapped  = 0;
+    size_t            capacity = 0; // per ring, not read back from the segment the peer can write
+    bool              creator = false;
+    Ring*             tx      = nullptr;
+    Ring*             rx      = nullptr;
+    std::byte*        tx_data = nullptr;
+    std::byte*        rx_data = nullptr;
+    std::mutex        send_lock; // rings have a single producer
+    std::thread       reader;
+    std::atomic<bool> stopping = false;
+    std::atomic<bool> broken   = false;
+
+    auto map(int fd, size_t size) -> bool;
+    auto reader_main(OnDatagram on_datagram, OnBroken on_broken) -> void;
+
+  public:
+    // capacity is per direction
+    auto create(size_t capacity) -> bool;
+    auto open(std::string_view name) -> bool;
+    // removes the name once the peer mapped the segment
+    auto unlink() -> void;
+    auto get_name() const -> const std::string&;
+    // on_datagram is called from a reader thread, the datagram is valid only during the call
+    // on_broken is called from the reader thread when the peer corrupted the ring, the link is unusable after it
+    auto start(OnDatagram on_datagram, OnBroken on_broken) -> void;
+    auto stop() -> void;
+    auto is_broken() const -> bool;
+    // false if the ring is full or the link is broken, the datagram is then dropped
+    auto send(std::span<const std::byte> datagram) -> bool;
+
+    ~ShmLink();
+};
+} // namespace p2p::ice
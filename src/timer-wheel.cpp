@@ -0,0 +1,127 @@
+#include <algorithm>
+#include <utility>
+
+#include "timer-wheel.hpp"
+
+namespace {
+auto unlink(TimerLink& link) -> void {
+    link.prev->next = link.next;
+    link.next->prev = link.prev;
+    link.prev       = nullptr;
+    link.next       = nullptr;
+}
+
+auto link_tail(TimerLink& head, TimerLink& link) -> void {
+    link.prev       = head.prev;
+    link.next       = &head;
+    head.prev->next = &link;
+    head.prev       = &link;
+}
+} // namespace
+
+auto Timer::cancel() -> void {
+    if(!is_armed()) {
+        return;
+    }
+    unlink(*this);
+    wheel->armed -= 1;
+}
+
+Timer::~Timer() {
+    cancel();
+}
+
+auto TimerWheel::insert(Timer& timer) -> void {
+    constexpr auto range = uint64_t(1) << (slot_bits * levels);
+
+    // timers beyond the range are parked at its end and inserted again from there
+    const auto expire = std::min(timer.expire, current + range - 1);
+    const auto delta  = expire - current;
+    auto       level  = 0;
+    while(delta >= (uint64_t(1) << (slot_bits * (level + 1)))) {
+        level += 1;
+    }
+    const auto slot = (expire >> (slot_bits * level)) & slot_mask;
+    link_tail(wheels[level][slot], timer);
+}
+
+auto TimerWheel::cascade(const int level) -> void {
+    auto& head = wheels[level][(current >> (slot_bits * level)) & slot_mask];
+    while(head.next != &head) {
+        auto& timer = *static_cast<Timer*>(head.next);
+        unlink(timer);
+        insert(timer);
+    }
+}
+
+auto TimerWheel::arm(Timer& timer, const Clock::duration delay, std::function<void()> callback) -> void {
+    timer.cancel();
+
+    // round up so that the timer never fires early
+    const auto elapsed = Clock::now() - origin;
+    const auto ticks   = uint64_t((elapsed + delay + tick - Clock::duration(1)) / tick);
+    timer.wheel        = this;
+    timer.expire       = std::max(ticks, current + 1);
+    timer.callback     = std::move(callback);
+    insert(timer);
+    armed += 1;
+}
+
+auto TimerWheel::advance(const Clock::time_point now) -> void {
+    const auto target = uint64_t((now - origin) / tick);
+    while(current < target) {
+        if(armed == 0) {
+            current = target;
+            return;
+        }
+        current += 1;
+        for(auto level = 1; level < levels; level += 1) {
+            if(((current >> (slot_bits * level)) << (slot_bits * level)) != current) {
+                break;
+            }
+            cascade(level);
+        }
+
+        auto& head = wheels[0][current & slot_mask];
+        while(head.next != &head) {
+            auto& timer = *static_cast<Timer*>(head.next);
+            if(timer.expire > current) {
+                unlink(timer);
+                insert(timer);
+                continue;
+            }
+            timer.cancel();
+            // the callback may destroy the timer itself
+            auto callback = std::move(timer.callback);
+            callback();
+        }
+    }
+}
+
+auto TimerWheel::next_expiry() const -> std::optional<Clock::time_point> {
+    if(armed == 0) {
+        return std::nullopt;
+    }
+    // timers on higher levels are cascaded at the next level 1 boundary
+    const auto boundary = ((current >> slot_bits) + 1) << slot_bits;
+    auto       next     = boundary;
+    for(auto expire = current + 1; expire < boundary; expire += 1) {
+        const auto& head = wheels[0][expire & slot_mask];
+        if(head.next != &head) {
+            next = expire;
+            break;
+        }
+    }
+    return origin + tick * int64_t(next);
+}
+
+TimerWheel::TimerWheel(const Clock::duration tick)
+    : origin(Clock::now()),
+      tick(tick) {
+    for(auto& wheel : wheels) {
+        for(auto& head : wheel) {
+            head.prev = &head;
+            head.next = &head;
+        }
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <optional>
+
+class TimerWheel;
+
+struct TimerLink {
+    TimerLink* prev = nullptr;
+    TimerLink* next = nullptr;
+};
+
+// destroying an armed timer cancels it
+struct Timer : TimerLink {
+    TimerWheel*           wheel  = nullptr;
+    uint64_t              expire = 0; // in ticks
+    std::function<void()> callback;
+
+    auto is_armed() const -> bool {
+        return prev != nullptr;
+    }
+
+    auto cancel() -> void;
+
+    Timer() = default;
+    Timer(const Timer&) = delete;
+    ~Timer();
+};
+
+// hierarchical timing wheel, O(1) arm and cancel
+class TimerWheel {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+  private:
+    static constexpr auto slot_bits = 6;
+    static constexpr auto slots     = 1 << slot_bits;
+    static constexpr auto slot_mask = slots - 1;
+    static constexpr auto levels    = 4;
+
+    std::array<std::array<TimerLink, slots>, levels> wheels;
+    Clock::time_point                                origin;
+    Clock::duration                                  tick;
+    uint64_t                                         current = 0; // in ticks
+    size_t                                           armed   = 0;
+
+    auto insert(Timer& timer) -> void;
+    auto cascade(int level) -> void;
+
+    friend struct Timer;
+
+  public:
+    auto arm(Timer& timer, Clock::duration delay, std::function<void()> callback) -> void;
+    // fire all timers expired by now
+    auto advance(Clock::time_point now = Clock::now()) -> void;
+    // when advance has work to do next, at least once per level 1 slot while timers are armed
+    auto next_expiry() const -> std::optional<Clock::time_point>;
+
+    TimerWheel(Clock::duration tick = std::chrono::milliseconds(10));
+    TimerWheel(const TimerWheel&) = delete;
+};
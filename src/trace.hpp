@@ -0,0 +1,86 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// link setup timelines in chrome trace event format
+namespace p2p::trace {
+struct Mark {
+    const char* name;
+    int64_t     time; // unix time in microseconds, comparable between hosts
+};
+
+inline auto now() -> int64_t {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+class Timeline {
+  private:
+    mutable std::mutex lock;
+    std::vector<Mark>  marks;
+
+  public:
+    auto mark(const char* const name, const int64_t time = now()) -> void {
+        auto guard = std::lock_guard(lock);
+        marks.push_back({name, time});
+    }
+
+    auto get_marks() const -> std::vector<Mark> {
+        auto guard = std::lock_guard(lock);
+        return marks;
+    }
+
+    auto empty() const -> bool {
+        auto guard = std::lock_guard(lock);
+        return marks.empty();
+    }
+
+    auto clear() -> void {
+        auto guard = std::lock_guard(lock);
+        marks.clear();
+    }
+};
+
+inline auto escape_json(const std::string_view str) -> std::string {
+    auto ret = std::string();
+    for(const auto c : str) {
+        if(c == '"' || c == '\\') {
+            ret += '\\';
+            ret += c;
+        } else if(uint8_t(c) < 0x20) {
+            constexpr auto hex = "0123456789abcdef";
+            ret += "\\u00";
+            ret += hex[c >> 4];
+            ret += hex[c & 0x0f];
+        } else {
+            ret += c;
+        }
+    }
+    return ret;
+}
+
+// instant events for each mark and complete events spanning consecutive marks
+// every event is followed by ",\n"
+inline auto append_chrome_events(std::string& out, const Timeline& timeline, const int pid, const int tid, const std::string_view thread_name) -> void {
+    const auto marks = timeline.get_marks();
+    const auto ids   = std::to_string(pid) + ",\"tid\":" + std::to_string(tid);
+
+    out += R"({"name":"thread_name","ph":"M","pid":)" + ids + R"(,"args":{"name":")" + escape_json(thread_name) + "\"}},\n";
+    for(auto i = size_t(0); i < marks.size(); i += 1) {
+        const auto& mark = marks[i];
+        out += R"({"name":")" + std::string(mark.name) + R"(","ph":"i","s":"t","ts":)" + std::to_string(mark.time) + ",\"pid\":" + ids + "},\n";
+        if(i + 1 < marks.size()) {
+            const auto& next = marks[i + 1];
+            out += R"({"name":")" + std::string(mark.name) + " -> " + next.name + R"(","ph":"X","ts":)" + std::to_string(mark.time) +
+                   ",\"dur\":" + std::to_string(next.time - mark.time) + ",\"pid\":" + ids + "},\n";
+        }
+    }
+}
+
+inline auto process_name_event(const int pid, const std::string_view name) -> std::string {
+    return R"({"name":"process_name","ph":"M","pid":)" + std::to_string(pid) + R"(,"args":{"name":")" + escape_json(name) + "\"}},\n";
+}
+} // namespace p2p::trace
@@ -0,0 +1,101 @@
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+#include <netdb.h>
+#include <openssl/hmac.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "udp-relay-link.hpp"
+#include "macros/unwrap.hpp"
+#include "peer-linker-protocol.hpp"
+
+namespace p2p::ice {
+namespace {
+// an idle endpoint registers again this often to keep the nat mapping
+constexpr auto keepalive_interval = timeval{.tv_sec = 10, .tv_usec = 0};
+constexpr auto socket_buffer      = 4 * 1024 * 1024;
+} // namespace
+
+auto UdpRelayLink::reader_main(const OnDatagram on_datagram) -> void {
+    auto buffer = std::array<std::byte, 2048>();
+    while(!stopping) {
+        const auto size = recv(fd, buffer.data(), buffer.size(), 0);
+        if(size > 0) {
+            on_datagram(std::span(buffer.data(), size_t(size)));
+        } else if(size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            send({});
+        } else if(size < 0 && errno != EINTR && errno != ECONNREFUSED) {
+            // relay unreachable, datagrams are dropped until the session goes back to direct
+            return;
+        }
+    }
+}
+
+auto UdpRelayLink::start(const std::string& address, const uint16_t port, const uint64_t token, const std::span<const std::byte> key, OnDatagram on_datagram) -> bool {
+    ensure(key.size() == this->key.size(), "invalid udp relay key");
+    const auto hints  = addrinfo{.ai_family = AF_UNSPEC, .ai_socktype = SOCK_DGRAM};
+    auto       result = (addrinfo*)(nullptr);
+    ensure(getaddrinfo(address.data(), std::to_string(port).data(), &hints, &result) == 0, "failed to resolve udp relay address");
+    for(auto info = result; info != nullptr; info = info->ai_next) {
+        fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+        if(fd < 0) {
+            continue;
+        }
+        if(connect(fd, info->ai_addr, info->ai_addrlen) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+    ensure(fd >= 0, "failed to connect udp relay socket");
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &keepalive_interval, sizeof(keepalive_interval));
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &socket_buffer, sizeof(socket_buffer));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &socket_buffer, sizeof(socket_buffer));
+
+    this->token = token;
+    std::memcpy(this->key.data(), key.data(), key.size());
+    // register the endpoint so that the peer can reach us before we send anything
+    ensure(send({}));
+    reader = std::thread(&UdpRelayLink::reader_main, this, std::move(on_datagram));
+    return true;
+}
+
+auto UdpRelayLink::stop() -> void {
+    stopping = true;
+    if(fd >= 0) {
+        shutdown(fd, SHUT_RDWR);
+    }
+    if(reader.joinable()) {
+        reader.join();
+    }
+}
+
+auto UdpRelayLink::send(const std::span<const std::byte> datagram) -> bool {
+    using plink::proto::udp_relay_tag_size;
+    using plink::proto::UdpRelayHeader;
+
+    const auto header = UdpRelayHeader{.token = token, .seq = seq.fetch_add(1) + 1};
+    // reused to avoid an allocation per datagram
+    thread_local auto buffer = std::vector<std::byte>();
+    buffer.resize(sizeof(header) + datagram.size() + udp_relay_tag_size);
+    std::memcpy(buffer.data(), &header, sizeof(header));
+    std::memcpy(buffer.data() + sizeof(header), datagram.data(), datagram.size());
+    const auto content = sizeof(header) + datagram.size();
+    auto       hash    = std::array<unsigned char, EVP_MAX_MD_SIZE>();
+    auto       len     = 0u;
+    ensure(HMAC(EVP_sha256(), key.data(), key.size(), (const unsigned char*)buffer.data(), content, hash.data(), &len) != nullptr);
+    std::memcpy(buffer.data() + content, hash.data(), udp_relay_tag_size);
+    return ::send(fd, buffer.data(), buffer.size(), 0) >= 0;
+}
+
+UdpRelayLink::~UdpRelayLink() {
+    stop();
+    if(fd >= 0) {
+        close(fd);
+    }
+}
+} // namespace p2p::ice
@@ -0,0 +1,34 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <functional>
+#include <span>
+#include <string>
+#include <thread>
+
+namespace p2p::ice {
+// endpoint of a peer-linker udp relay allocation
+class UdpRelayLink {
+  public:
+    using OnDatagram = std::function<void(std::span<const std::byte> datagram)>;
+
+  private:
+    int                       fd    = -1;
+    uint64_t                  token = 0;
+    std::array<std::byte, 32> key;
+    std::atomic<uint64_t>     seq = 0; // of the last datagram sent
+    std::thread               reader;
+    std::atomic<bool>         stopping = false;
+
+    auto reader_main(OnDatagram on_datagram) -> void;
+
+  public:
+    // on_datagram is called from a reader thread, the datagram is valid only during the call
+    // token and key are from plink::proto::UdpRelayAllocated
+    auto start(const std::string& address, uint16_t port, uint64_t token, std::span<const std::byte> key, OnDatagram on_datagram) -> bool;
+    auto stop() -> void;
+    auto send(std::span<const std::byte> datagram) -> bool;
+
+    ~UdpRelayLink();
+};
+} // namespace p2p::ice
@@ -0,0 +1,219 @@
+#include <array>
+#include <cstring>
+
+#include <netinet/in.h>
+#include <openssl/crypto.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <unistd.h>
+
+#include "logger.hpp"
+#include "macros/unwrap.hpp"
+#include "metrics.hpp"
+#include "peer-linker-protocol.hpp"
+#include "udp-relay.hpp"
+
+namespace {
+constexpr auto batch_size        = 64;
+constexpr auto max_datagram_size = 2048; // larger ones are truncated and dropped
+constexpr auto socket_buffer     = 4 * 1024 * 1024;
+constexpr auto poll_interval     = timeval{.tv_sec = 0, .tv_usec = 100'000}; // to notice stop
+
+using p2p::plink::proto::udp_relay_tag_size;
+using p2p::plink::proto::UdpRelayHeader;
+
+auto verify_tag(const std::array<std::byte, 32>& key, const std::span<const std::byte> datagram) -> bool {
+    const auto content = datagram.first(datagram.size() - udp_relay_tag_size);
+    auto       hash    = std::array<unsigned char, EVP_MAX_MD_SIZE>();
+    auto       len     = 0u;
+    log_ensure(HMAC(EVP_sha256(), key.data(), key.size(), (const unsigned char*)content.data(), content.size(), hash.data(), &len) != nullptr);
+    return CRYPTO_memcmp(hash.data(), datagram.data() + content.size(), udp_relay_tag_size) == 0;
+}
+
+// accepts each sequence number once, within 64 below the highest accepted one
+auto accept_seq(uint64_t& last_seq, uint64_t& seen, const uint64_t seq) -> bool {
+    if(seq > last_seq) {
+        const auto shift = seq - last_seq;
+        seen             = (shift < 64 ? seen << shift : 0) | 1;
+        last_seq         = seq;
+        return true;
+    }
+    const auto age = last_seq - seq;
+    if(age >= 64 || (seen >> age & 1) != 0) {
+        return false;
+    }
+    seen |= uint64_t(1) << age;
+    return true;
+}
+} // namespace
+
+auto UdpRelay::issue_token() -> uint64_t {
+    while(true) {
+        const auto token = uint64_t(token_source()) << 32 | token_source();
+        if(token != 0 && sides.find(token) == sides.end()) {
+            return token;
+        }
+    }
+}
+
+auto UdpRelay::worker_main() -> void {
+    auto buffers   = std::vector<std::array<std::byte, max_datagram_size>>(batch_size);
+    auto sources   = std::array<sockaddr_storage, batch_size>();
+    auto rx_iovecs = std::array<iovec, batch_size>();
+    auto rx        = std::array<mmsghdr, batch_size>();
+    auto targets   = std::array<sockaddr_storage, batch_size>();
+    auto tx_iovecs = std::array<iovec, batch_size>();
+    auto tx        = std::array<mmsghdr, batch_size>();
+    for(auto i = 0; i < batch_size; i += 1) {
+        rx_iovecs[i]             = iovec{buffers[i].data(), buffers[i].size()};
+        rx[i].msg_hdr.msg_iov    = &rx_iovecs[i];
+        rx[i].msg_hdr.msg_iovlen = 1;
+        rx[i].msg_hdr.msg_name   = &sources[i];
+        tx[i].msg_hdr.msg_iov    = &tx_iovecs[i];
+        tx[i].msg_hdr.msg_iovlen = 1;
+        tx[i].msg_hdr.msg_name   = &targets[i];
+    }
+
+    while(!stopping) {
+        for(auto& message : rx) {
+            message.msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+        }
+        const auto received = recvmmsg(fd, rx.data(), batch_size, MSG_WAITFORONE, nullptr);
+        if(received <= 0) {
+            continue; // timeout or interrupted
+        }
+
+        auto count = 0;
+        auto bytes = size_t(0);
+        {
+            auto guard = std::lock_guard(lock);
+            for(auto i = 0; i < received; i += 1) {
+                const auto& header = rx[i].msg_hdr;
+                const auto  size   = size_t(rx[i].msg_len);
+                if(size < sizeof(UdpRelayHeader) + udp_relay_tag_size || (header.msg_flags & MSG_TRUNC)) {
+                    continue;
+                }
+                auto relay_header = UdpRelayHeader();
+                std::memcpy(&relay_header, buffers[i].data(), sizeof(relay_header));
+                const auto it = sides.find(relay_header.token);
+                if(it == sides.end()) {
+                    continue;
+                }
+                auto& [allocation, index] = it->second;
+                auto& source              = allocation->endpoints[index];
+                // the token is sent in the clear, only the key proves the sender
+                if(!verify_tag(source.key, std::span(buffers[i].data(), size))) {
+                    continue;
+                }
+                const auto newest = relay_header.seq > source.last_seq;
+                if(!accept_seq(source.last_seq, source.seen, relay_header.seq)) {
+                    continue;
+                }
+                if(newest) {
+                    std::memcpy(&source.address, header.msg_name, header.msg_namelen);
+                    source.address_len = header.msg_namelen;
+                }
+
+                const auto  payload_size = size - sizeof(UdpRelayHeader) - udp_relay_tag_size;
+                const auto& target       = allocation->endpoints[1 - index];
+                if(payload_size == 0 || target.address_len == 0) {
+                    continue;
+                }
+                // shared with the websocket relay of the user
+                if(source.bucket != nullptr && allocation->rate != 0 && !source.bucket->consume(payload_size, allocation->rate)) {
+                    continue;
+                }
+                std::memcpy(&targets[count], &target.address, target.address_len);
+                tx[count].msg_hdr.msg_namelen = target.address_len;
+                tx_iovecs[count]              = iovec{buffers[i].data() + sizeof(UdpRelayHeader), payload_size};
+                count += 1;
+                bytes += payload_size;
+            }
+        }
+
+        for(auto sent = 0; sent < count;) {
+            const auto result = sendmmsg(fd, tx.data() + sent, count - sent, 0);
+            if(result <= 0) {
+                // the socket buffer is full or the target is unreachable, drop like a router would
+                break;
+            }
+            sent += result;
+        }
+        metrics::add(metrics::Metric::RelayedPackets, count);
+        metrics::add(metrics::Metric::RelayedBytes, bytes);
+    }
+}
+
+auto UdpRelay::start(const uint16_t port) -> bool {
+    fd = socket(AF_INET6, SOCK_DGRAM, 0);
+    ensure(fd >= 0, "failed to create udp relay socket");
+    const auto no = 0;
+    setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &no, sizeof(no)); // ipv4 peers too
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &socket_buffer, sizeof(socket_buffer));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &socket_buffer, sizeof(socket_buffer));
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &poll_interval, sizeof(poll_interval));
+    auto addr        = sockaddr_in6();
+    addr.sin6_family = AF_INET6;
+    addr.sin6_port   = htons(port);
+    addr.sin6_addr   = in6addr_any;
+    ensure(bind(fd, (sockaddr*)&addr, sizeof(addr)) == 0, "failed to bind udp relay port ", port);
+    this->port = port;
+    worker     = std::thread(&UdpRelay::worker_main, this);
+    log_info("relaying udp on port ", port);
+    return true;
+}
+
+auto UdpRelay::is_running() const -> bool {
+    return worker.joinable();
+}
+
+auto UdpRelay::get_port() const -> uint16_t {
+    return port;
+}
+
+auto UdpRelay::allocate(const uint64_t rate, TokenBucket* const first_bucket, TokenBucket* const second_bucket) -> std::optional<UdpRelayCredentials> {
+    auto credentials = UdpRelayCredentials();
+    ensure(RAND_bytes((unsigned char*)credentials.first.key.data(), credentials.first.key.size()) == 1);
+    ensure(RAND_bytes((unsigned char*)credentials.second.key.data(), credentials.second.key.size()) == 1);
+
+    auto guard               = std::lock_guard(lock);
+    credentials.first.token  = issue_token();
+    credentials.second.token = issue_token();
+    while(credentials.second.token == credentials.first.token) {
+        credentials.second.token = issue_token();
+    }
+    auto& allocation                = allocations[credentials.first.token];
+    allocation.credentials          = credentials;
+    allocation.rate                 = rate;
+    allocation.endpoints[0].key     = credentials.first.key;
+    allocation.endpoints[0].bucket  = first_bucket;
+    allocation.endpoints[1].key     = credentials.second.key;
+    allocation.endpoints[1].bucket  = second_bucket;
+    sides[credentials.first.token]  = Side{&allocation, 0};
+    sides[credentials.second.token] = Side{&allocation, 1};
+    return credentials;
+}
+
+auto UdpRelay::release(const uint64_t token) -> void {
+    auto       guard = std::lock_guard(lock);
+    const auto it    = sides.find(token);
+    if(it == sides.end()) {
+        return;
+    }
+    const auto& credentials = it->second.allocation->credentials;
+    const auto  first       = credentials.first.token;
+    const auto  second      = credentials.second.token;
+    sides.erase(first);
+    sides.erase(second);
+    allocations.erase(first);
+}
+
+UdpRelay::~UdpRelay() {
+    stopping = true;
+    if(worker.joinable()) {
+        worker.join();
+    }
+    if(fd >= 0) {
+        close(fd);
+    }
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <thread>
+#include <unordered_map>
+
+#include <sys/socket.h>
+
+#include "server.hpp"
+
+// credentials of one endpoint of an allocation, sent to its pad over the websocket
+struct UdpRelayCredential {
+    uint64_t                  token;
+    std::array<std::byte, 32> key;
+};
+
+struct UdpRelayCredentials {
+    UdpRelayCredential first;
+    UdpRelayCredential second;
+};
+
+// forwards datagrams between the two endpoints of each allocation on a dedicated thread
+// datagrams are laid out as in plink::proto::UdpRelayHeader, and dropped unless the tag matches the key of the token
+// the endpoint of a token follows the source address of its newest authentic datagram, so nat rebinding is handled
+// payloads are forwarded without header and tag, empty ones only register the endpoint
+class UdpRelay {
+  private:
+    struct Endpoint {
+        sockaddr_storage          address;
+        socklen_t                 address_len = 0; // 0 until registered
+        std::array<std::byte, 32> key;
+        uint64_t                  last_seq = 0; // highest accepted
+        uint64_t                  seen     = 0; // bit n is set if last_seq - n was accepted
+        TokenBucket*              bucket   = nullptr; // relay quota of the user of this side, nullptr for unlimited
+    };
+
+    struct Allocation {
+        UdpRelayCredentials credentials;
+        Endpoint            endpoints[2];
+        uint64_t            rate = 0; // bytes per second, 0 for unlimited
+    };
+
+    struct Side {
+        Allocation* allocation;
+        int         index;
+    };
+
+    int                                      fd   = -1;
+    uint16_t                                 port = 0;
+    std::random_device                       token_source;
+    std::mutex                               lock;
+    std::unordered_map<uint64_t, Allocation> allocations; // by first token
+    std::unordered_map<uint64_t, Side>       sides;       // by either token
+    std::thread                              worker;
+    std::atomic<bool>                        stopping = false;
+
+    auto issue_token() -> uint64_t;
+    auto worker_main() -> void;
+
+  public:
+    auto start(uint16_t port) -> bool;
+    auto is_running() const -> bool;
+    auto get_port() const -> uint16_t;
+    // datagrams of each side are charged to its bucket at rate, buckets must outlive the allocation
+    auto allocate(uint64_t rate, TokenBucket* first_bucket, TokenBucket* second_bucket) -> std::optional<UdpRelayCredentials>;
+    // either token of the allocation
+    auto release(uint64_t token) -> void;
+
+    ~UdpRelay();
+};
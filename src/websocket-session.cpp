@@ -18,6 +18,13 @@ auto WebSocketSession::on_packet_received(const std::span<const std::byte> paylo
 }
 
 auto WebSocketSession::handle_raw_packet(std::span<const std::byte> payload) -> void {
+    if(const auto header = p2p::proto::extract_header(payload); header != nullptr && header->type == proto::Type::Fragment) {
+        // a broken fragment cannot be answered, the packet id is in the first one
+        if(!reassembler.feed(fragment_pool, payload, [this](const std::span<const std::byte> packet) { handle_raw_packet(packet); return true; })) {
+            line_warn("fragment handling failed");
+        }
+        return;
+    }
     if(!on_packet_received(payload)) {
         line_warn("payload handling failed");
 
@@ -35,7 +42,7 @@ auto WebSocketSession::send_packet(std::vector<std::byte> payload) -> bool {
     const auto id = allocate_packet_id();
 
     std::bit_cast<proto::Packet*>(payload.data())->id = id;
-    ensure(websocket_context.send(payload));
+    ensure(send_frame(payload));
     unwrap(value, wait_for_event(EventKind::Result, id));
     ensure(value == 1);
     return true;
@@ -46,10 +53,14 @@ auto WebSocketSession::send_packet_detached(const EventCallback callback, const
 
     std::bit_cast<proto::Packet*>(payload.data())->id = id;
     ensure(events.register_callback(EventKind::Result, id, callback));
-    ensure(websocket_context.send(payload));
+    ensure(send_frame(payload));
     return true;
 }
 
+auto WebSocketSession::send_frame(const std::span<const std::byte> payload) -> bool {
+    return proto::for_each_fragment(payload, [this](const std::span<const std::byte> fragment) { return websocket_context.send(fragment); });
+}
+
 auto WebSocketSession::on_disconnected() -> void {
     line_print("session disconnected");
 }
@@ -2,6 +2,7 @@
 #include <thread>
 
 #include "event-manager.hpp"
+#include "fragment.hpp"
 #include "protocol-helper.hpp"
 #include "ws/client.hpp"
 
@@ -32,8 +33,12 @@ class WebSocketSession {
     ws::client::Context websocket_context;
     std::thread         signaling_worker;
     uint32_t            packet_id = 0;
+    proto::BufferPool   fragment_pool; // used only by the signaling worker
+    proto::Reassembler  reassembler;
 
     auto handle_raw_packet(std::span<const std::byte> payload) -> void;
+    // fragments packets larger than max_packet_size
+    auto send_frame(std::span<const std::byte> payload) -> bool;
     auto send_packet(std::vector<std::byte> payload) -> bool;
     auto send_packet_detached(EventCallback callback, std::vector<std::byte> payload) -> bool;
 
@@ -71,12 +76,12 @@ class WebSocketSession {
 
     template <class... Args>
     auto send_result(uint16_t type, uint16_t id, Args... args) -> void {
-        websocket_context.send(proto::build_packet(type, id, std::forward<Args>(args)...));
+        send_frame(proto::build_packet(type, id, std::forward<Args>(args)...));
     }
 
     template <class... Args>
     auto send_generic_packet(uint16_t type, uint16_t id, Args... args) -> void {
-        websocket_context.send(proto::build_packet(type, id, std::forward<Args>(args)...));
+        send_frame(proto::build_packet(type, id, std::forward<Args>(args)...));
     }
 
     virtual ~WebSocketSession() {}